@@ -3,11 +3,18 @@
 
 #include <iostream>
 #include <chrono>
+#include <fstream>
 
 Graphics* Graphics::current_engine;
 
 const size_t MAX_CONCURRENT_FRAMES = 2;
 
+// Uniform data written per frame in flight
+const vk::DeviceSize UNIFORM_RING_FRAME_SIZE = 1024 * 1024;
+
+// Bytes of device local memory relocated per frame when compacting memory blocks
+const vk::DeviceSize DEFRAGMENT_BYTES_PER_FRAME = 4 * 1024 * 1024;
+
 const std::vector<Vertex> vertices = {
     {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
     {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
@@ -55,6 +62,7 @@ Graphics::Graphics() {
     try{
         dimensions = vk::Extent2D(640, 480);
         check_support();
+        open_asset_pack();
         create_instance();
         pick_physical_device();
         pick_queue_family();
@@ -67,13 +75,24 @@ Graphics::Graphics() {
         create_pipeline();
         create_framebuffers();
         create_command_pool();
-        memoryManager = vk_mem::Manager(&physical_device, &device, &queue, &commandPool);
+        #ifdef VK_EXT_memory_budget
+        memoryManager = vk_mem::Manager(std::make_unique<vk_mem::VulkanDevice>(&physical_device, &device, vk_help::has_device_extension(physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)));
+        #else
+        memoryManager = vk_mem::Manager(std::make_unique<vk_mem::VulkanDevice>(&physical_device, &device));
+        #endif
+        transferQueue = vk_mem::TransferQueue(
+            &memoryManager,
+            &device,
+            vk_mem::QueueContext {&transfer_queue, transfer_queue_family, &transferCommandPool},
+            vk_mem::QueueContext {&queue, queue_family, &commandPool}
+        );
         create_uniform_buffers();
         create_descriptor_pool();
         create_descriptor_set();
         create_vertex_buffers();
         create_index_buffers();
         create_texture_buffers();
+        transferQueue.submit();
         create_command_buffers();
         create_sync_objects();
 
@@ -118,6 +137,28 @@ void Graphics::check_support() {
     }
 }
 
+void Graphics::open_asset_pack() {
+    if (!std::ifstream("assets.pack").good()) {
+        std::cout << "No asset pack, loading loose files" << std::endl;
+        return;
+    }
+
+    assetPack = asset_pack::Reader("assets.pack");
+    std::cout << "Mapped asset pack with " << assetPack.get_assets().size() << " assets" << std::endl;
+}
+
+bool Graphics::has_asset(const std::string &name) {
+    return assetPack.find(name) != nullptr || std::ifstream(name).good();
+}
+
+vk::ShaderModule Graphics::load_shader(const std::string &name) {
+    // Pack payloads are aligned, SPIR-V can be handed over from the mapping directly
+    if (const asset_pack::Asset *asset = assetPack.find(name)) {
+        return vk_help::create_shader_module(device, asset->data, asset->size);
+    }
+    return vk_help::load_precompiled_shader(device, name);
+}
+
 void Graphics::create_instance() {
     this->instance = vk_help::create_glfw_instance(AppName, EngineName);
 }
@@ -134,17 +175,19 @@ void Graphics::pick_queue_family() {
     assert(physical_device);
 
     this->queue_family = vk_help::pick_queue_family(physical_device);
+    this->transfer_queue_family = vk_help::pick_transfer_queue_family(physical_device, queue_family);
 }
 
 void Graphics::create_logical_device() {
 
     assert(physical_device);
 
-    device = vk_help::create_device_khr(physical_device, queue_family);
+    device = vk_help::create_device_khr(physical_device, {queue_family, transfer_queue_family});
 
     // Picking a queue
 
     queue = device.getQueue(this->queue_family,0);
+    transfer_queue = device.getQueue(this->transfer_queue_family, 0);
 }
 
 void Graphics::create_surface() {
@@ -242,11 +285,11 @@ void Graphics::create_render_pass() {
 
 void Graphics::create_descriptor_set_layout() {
     vk::DescriptorSetLayoutBinding ubo_layout_binding(
-        0,                                  // Binding
-        vk::DescriptorType::eUniformBuffer, // Type
-        1,                                  // Count
-        vk::ShaderStageFlagBits::eVertex,   // State flags
-        nullptr                             // Sampler
+        0,                                          // Binding
+        vk::DescriptorType::eUniformBufferDynamic,  // Type
+        1,                                          // Count
+        vk::ShaderStageFlagBits::eVertex,           // State flags
+        nullptr                                     // Sampler
     );
 
     vk::DescriptorSetLayoutCreateInfo create_info(
@@ -263,8 +306,8 @@ void Graphics::create_pipeline() {
     assert(device);
     assert(renderPass);
 
-    vk::ShaderModule vertex_shader = vk_help::load_precompiled_shader(device, "shaders/simple.vert.spv");
-    vk::ShaderModule fragment_shader = vk_help::load_precompiled_shader(device, "shaders/simple.frag.spv");
+    vk::ShaderModule vertex_shader = load_shader("shaders/simple.vert.spv");
+    vk::ShaderModule fragment_shader = load_shader("shaders/simple.frag.spv");
 
     
     vk::PipelineShaderStageCreateInfo vert_stage_info(
@@ -442,117 +485,70 @@ void Graphics::create_framebuffers() {
 
 void Graphics::create_command_pool() {
     vk::CommandPoolCreateInfo create_info(
-        vk::CommandPoolCreateFlags(),
+        vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
         queue_family                // Queue to use
     );
 
     commandPool = device.createCommandPool(create_info);
 
     assert(commandPool);
+
+    vk::CommandPoolCreateInfo transfer_create_info(
+        vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+        transfer_queue_family       // Queue to use
+    );
+
+    transferCommandPool = device.createCommandPool(transfer_create_info);
+
+    assert(transferCommandPool);
 }
 
 void Graphics::create_vertex_buffers() {
 
     vk::DeviceSize buffer_size = sizeof(vertices[0]) * vertices.size();
 
-    vk_mem::BufferHandle staging_buffer = memoryManager.create_transfer_buffer(buffer_size);
     vertexBuffer = memoryManager.create_vertex_buffer(buffer_size);
 
-    void* data = memoryManager.mapMemory(staging_buffer);
-    memcpy(data, vertices.data(), (size_t) buffer_size);
-    memoryManager.unmapMemory(staging_buffer);
-
-    memoryManager.copy_buffer(staging_buffer, vertexBuffer);
-
-    memoryManager.free(staging_buffer);
-    
+    transferQueue.upload(vertices.data(), buffer_size, vertexBuffer);
 }
 
 void Graphics::create_index_buffers() {
 
     vk::DeviceSize buffer_size = sizeof(indices[0]) * indices.size();
 
-    vk_mem::BufferHandle staging_buffer = memoryManager.create_transfer_buffer(buffer_size);
     indexBuffer = memoryManager.create_index_buffer(buffer_size);
 
-    void* data = memoryManager.mapMemory(staging_buffer);
-    memcpy(data, indices.data(), (size_t) buffer_size);
-    memoryManager.unmapMemory(staging_buffer);
-
-    memoryManager.copy_buffer(staging_buffer, indexBuffer);
-
-    memoryManager.free(staging_buffer);
+    transferQueue.upload(indices.data(), buffer_size, indexBuffer);
 }
 
 void Graphics::create_uniform_buffers() {
 
-    vk::DeviceSize buffer_size = sizeof(Transformations);
-
-    uniformBuffers.resize(swapChainImages.size());
-
-    for (auto &buffer : uniformBuffers) {
-        buffer = memoryManager.create_uniform_buffer(buffer_size);
-    }
+    uniformRing = vk_mem::FrameRing(&memoryManager, UNIFORM_RING_FRAME_SIZE, MAX_CONCURRENT_FRAMES);
 }
 
 void Graphics::create_texture_buffers() {
-    std::cout << "Creating texture buffers" << std::endl;
-    auto image = vk_help::load_image("textures/texture.jpg");
-
-    vk::DeviceSize buffer_size = image.width * image.height * 4;
-
-    vk_mem::BufferHandle staging_buffer = memoryManager.create_transfer_buffer(buffer_size);
-    
-    {
-        vk::ImageCreateInfo create_info(
-            vk::ImageCreateFlags(),
-            vk::ImageType::e2D,                         // Type
-            vk::Format::eR8G8B8A8Unorm,                 // Format
-            vk::Extent3D(image.width, image.height, 1), // Extent
-            1,                                          // Mip levels
-            1,                                          // Array layers
-            vk::SampleCountFlagBits::e1,                // Samples
-            vk::ImageTiling::eOptimal,                  // Tiling
-            vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, // Usage
-            vk::SharingMode::eExclusive,                // Sharing mode
-            1,                                          // Queue family count
-            &queue_family,                              // Queue families
-            vk::ImageLayout::eUndefined                 // Layout
-        );
-
-        textureImage = device.createImage(create_info);
+    // Decoded in the background, the first submit carries the placeholder
+    textureStreamer = vk_mem::TextureStreamer(&memoryManager, &transferQueue, &physical_device, &device);
+    textureStreamer.set_asset_pack(&assetPack);
+    textureStreamer.enable_cache("texture_cache");
+
+    // A pre-compressed version takes precedence, its format comes from the container
+    std::string texture_path = "textures/texture.ktx2";
+    if (!has_asset(texture_path)) {
+        texture_path = "textures/texture.jpg";
     }
-
-    {
-        auto mem_reqs = device.getImageMemoryRequirements(textureImage);
-        auto mem_type = memoryManager.find_memory_type(mem_reqs, vk::MemoryPropertyFlagBits::eDeviceLocal);
-        std::cout << "Allocating memory of type " << mem_type << " for image." << std::endl;
-        vk::MemoryAllocateInfo alloc_info(mem_reqs.size, mem_type);
-
-        textureImageMemory = device.allocateMemory(alloc_info);
-
-        device.bindImageMemory(textureImage, textureImageMemory, 0 /* memory offset */);
-    }
-
-    void* data = memoryManager.mapMemory(staging_buffer);
-    memcpy(data, image.image, (size_t) buffer_size);
-    memoryManager.unmapMemory(staging_buffer);
-
-    memoryManager.copy_buffer(staging_buffer, textureImage, image.width, image.height, vk::Format::eR8G8B8A8Unorm, vk::ImageLayout::eUndefined);
-
-    memoryManager.free(staging_buffer);
-    std::cout << "Finished wih texture" << std::endl;
+    texture = textureStreamer.load(texture_path);
 }
 
 void Graphics::create_descriptor_pool() {
     vk::DescriptorPoolSize pool_size(
-        vk::DescriptorType::eUniformBuffer, // Type
-        (uint32_t) swapChainImages.size()   // Count
+        vk::DescriptorType::eUniformBufferDynamic,  // Type
+        1                                           // Count
     );
 
     vk::DescriptorPoolCreateInfo create_info(
         vk::DescriptorPoolCreateFlags(),
-        (uint32_t) swapChainImages.size(),  // Max sets
+        1,                                  // Max sets
         1,                                  // Pool count
         &pool_size                          // Pool sizes
     );
@@ -561,43 +557,40 @@ void Graphics::create_descriptor_pool() {
 }
 
 void Graphics::create_descriptor_set() {
-    std::vector<vk::DescriptorSetLayout> layouts(swapChainImages.size(), descriptorSetLayout);
-
     vk::DescriptorSetAllocateInfo alloc_info(
         descriptorPool,             // Descriptor pool
-        (uint32_t) swapChainImages.size(),  // Descriptor count
-        layouts.data()              // Descriptor layouts
+        1,                          // Descriptor count
+        &descriptorSetLayout        // Descriptor layouts
     );
-    
-    descriptorSets.resize(swapChainImages.size());
-    descriptorSets = device.allocateDescriptorSets(alloc_info);
 
+    descriptorSet = device.allocateDescriptorSets(alloc_info)[0];
 
-    for (size_t i = 0; i < swapChainImages.size(); i++) {
-        vk::DescriptorBufferInfo buffer_info(
-            memoryManager.get_buffer(uniformBuffers[i]),// Buffer
-            0,                                          // Offset
-            sizeof(Transformations)                     // Range
-        );
+    // Offset of each draw is given as a dynamic offset when binding
+    auto uniform_buffer = uniformRing.get_buffer();
 
-        vk::WriteDescriptorSet write_desc(
-            descriptorSets[i],                  // Dst set
-            0,                                  // Dst binding
-            0,                                  // Dst array element
-            1,                                  // Description count
-            vk::DescriptorType::eUniformBuffer, // Description type
-            nullptr,                            // Image info
-            &buffer_info,                       // Buffer info
-            nullptr                             // Texel buffer view
-        );
+    vk::DescriptorBufferInfo buffer_info(
+        uniform_buffer,                 // Buffer
+        uniform_buffer.buffer_offset,   // Offset
+        sizeof(Transformations)         // Range
+    );
 
-        device.updateDescriptorSets(1, &write_desc, 0, nullptr);
-    }
+    vk::WriteDescriptorSet write_desc(
+        descriptorSet,                              // Dst set
+        0,                                          // Dst binding
+        0,                                          // Dst array element
+        1,                                          // Description count
+        vk::DescriptorType::eUniformBufferDynamic,  // Description type
+        nullptr,                                    // Image info
+        &buffer_info,                               // Buffer info
+        nullptr                                     // Texel buffer view
+    );
+
+    device.updateDescriptorSets(1, &write_desc, 0, nullptr);
 }
 
 void Graphics::create_command_buffers() {
-    assert(swapChainFrameBuffers.size() != 0);
-    commandBuffers.resize(swapChainFrameBuffers.size());
+    // One command buffer per frame in flight, re-recorded every frame
+    commandBuffers.resize(MAX_CONCURRENT_FRAMES);
 
     vk::CommandBufferAllocateInfo alloc_info(
         commandPool,
@@ -606,7 +599,9 @@ void Graphics::create_command_buffers() {
     );
 
     commandBuffers = device.allocateCommandBuffers(alloc_info);
+}
 
+void Graphics::record_command_buffer(uint32_t image_index, uint32_t uniform_offset) {
     vk::ClearValue clear_color;
     clear_color.color.setFloat32({0.0f, 0.0f, 0.2f, 1.0f});
     std::vector<vk::ClearValue> clear_values = {clear_color};
@@ -616,76 +611,69 @@ void Graphics::create_command_buffers() {
         this->dimensions    // Extent
     );
 
+    vk::CommandBuffer *cmd = &commandBuffers[current_frame];
 
-    for (size_t i = 0; i < commandBuffers.size(); i++) {
-
-        vk::CommandBuffer *cmd = &commandBuffers[i];
+    vk::CommandBufferBeginInfo begin_info(
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+        nullptr // Inheritance
+    );
 
-        vk::CommandBufferBeginInfo begin_info(
-            vk::CommandBufferUsageFlagBits::eSimultaneousUse,
-            nullptr // Inheritance
-        );
+    cmd->begin(begin_info);
 
-        cmd->begin(begin_info);
+    memoryManager.defragment(*cmd, DEFRAGMENT_BYTES_PER_FRAME);
 
-        vk::RenderPassBeginInfo render_pass_info(
-            renderPass,                 // Render pass
-            swapChainFrameBuffers[i],   // Framebuffer
-            render_area,                // Render area
-            clear_values.size(),        // Clear value count
-            &clear_values[0]            // Clear values
-        );
-
-        cmd->beginRenderPass(render_pass_info, vk::SubpassContents::eInline);
+    vk::RenderPassBeginInfo render_pass_info(
+        renderPass,                         // Render pass
+        swapChainFrameBuffers[image_index], // Framebuffer
+        render_area,                        // Render area
+        clear_values.size(),                // Clear value count
+        &clear_values[0]                    // Clear values
+    );
 
-        cmd->bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+    cmd->beginRenderPass(render_pass_info, vk::SubpassContents::eInline);
 
-        auto vertex_buffer_container = memoryManager.get_buffer(vertexBuffer);
-        vk::Buffer vertex_buffers[] = {vertex_buffer_container};
-        vk::DeviceSize vertex_buffer_offsets[] = {0};
-        auto index_buffer = memoryManager.get_buffer(indexBuffer);
+    cmd->bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
 
+    auto vertex_buffer_container = memoryManager.get_buffer(vertexBuffer);
+    vk::Buffer vertex_buffers[] = {vertex_buffer_container};
+    vk::DeviceSize vertex_buffer_offsets[] = {vertex_buffer_container.buffer_offset};
+    auto index_buffer = memoryManager.get_buffer(indexBuffer);
 
-        cmd->bindVertexBuffers(
-            0,                      // First binding
-            1,                      // Buffer count
-            vertex_buffers,         // Internal buffer offsets
-            vertex_buffer_offsets   // Offsets
-        );
 
-        cmd->bindIndexBuffer(
-            index_buffer,           // Buffer
-            0,                      // Internal buffer offset
-            vk::IndexType::eUint16  // Index type
-        );
+    cmd->bindVertexBuffers(
+        0,                      // First binding
+        1,                      // Buffer count
+        vertex_buffers,         // Internal buffer offsets
+        vertex_buffer_offsets   // Offsets
+    );
 
-        
-        cmd->bindDescriptorSets(
-            vk::PipelineBindPoint::eGraphics,   // Pipeline bind point
-            pipelineLayout,                     // Pipeline layout
-            0,                                  // First set
-            1,                                  // Set count
-            &descriptorSets[i],                 // Descriptor sets
-            0,                                  // Dynamic offset count
-            nullptr                             // Dynamic offsets
-        );
-        
-        
-
-        cmd->drawIndexed(
-            (uint32_t) indices.size(), // Index count
-            1, // Instance count
-            0, // First index,
-            0, // Vertex offset
-            0  // First instance
-        );
+    cmd->bindIndexBuffer(
+        index_buffer,               // Buffer
+        index_buffer.buffer_offset, // Internal buffer offset
+        vk::IndexType::eUint16      // Index type
+    );
 
-        cmd->endRenderPass();
+    cmd->bindDescriptorSets(
+        vk::PipelineBindPoint::eGraphics,   // Pipeline bind point
+        pipelineLayout,                     // Pipeline layout
+        0,                                  // First set
+        1,                                  // Set count
+        &descriptorSet,                     // Descriptor sets
+        1,                                  // Dynamic offset count
+        &uniform_offset                     // Dynamic offsets
+    );
 
-        cmd->end();
-    }
+    cmd->drawIndexed(
+        (uint32_t) indices.size(), // Index count
+        1, // Instance count
+        0, // First index,
+        0, // Vertex offset
+        0  // First instance
+    );
 
+    cmd->endRenderPass();
 
+    cmd->end();
 }
 
 void Graphics::create_sync_objects() {
@@ -704,7 +692,7 @@ void Graphics::create_sync_objects() {
 
 const auto start_time = std::chrono::steady_clock::now();
 
-void Graphics::update_uniform_buffers(uint32_t image_index) {
+uint32_t Graphics::update_uniform_buffers() {
     auto current_time = std::chrono::steady_clock::now();
 
     float time = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count() / 1000.0f;
@@ -731,9 +719,7 @@ void Graphics::update_uniform_buffers(uint32_t image_index) {
     );
     t.proj[1][1] *= -1; // Y-coordinate fix
 
-    void* data = memoryManager.mapMemory(uniformBuffers[image_index]);
-    memcpy(data, &t, sizeof(t));
-    memoryManager.unmapMemory(uniformBuffers[image_index]);
+    return uniformRing.push(t);
 
 }
 
@@ -753,6 +739,16 @@ void Graphics::draw_frame() {
         &frameSyncObjects[current_frame].inFlightFence  // Fences
     );
 
+    // Frame has finished on the GPU, its uniform region can be rewritten
+    uniformRing.begin_frame(current_frame);
+
+    // Every frame up to the one that last used this fence has completed
+    uint64_t completed_frames = frame_number + 1 >= MAX_CONCURRENT_FRAMES ? frame_number + 1 - MAX_CONCURRENT_FRAMES : 0;
+    memoryManager.begin_frame(frame_number, completed_frames);
+
+    transferQueue.collect();
+    textureStreamer.update();
+
     if (has_been_resized) {
         recreate_swapchain();
     }
@@ -767,7 +763,7 @@ void Graphics::draw_frame() {
         throw std::runtime_error("Failed to acquire image");
     }
 
-    update_uniform_buffers(image_index);
+    record_command_buffer(image_index, update_uniform_buffers());
 
     std::vector<vk::Semaphore> wait_semaphores = {frameSyncObjects[current_frame].imageAvailableSemaphore};
     std::vector<vk::Semaphore> signal_semaphores = {frameSyncObjects[current_frame].renderFinishedSemaphore};
@@ -777,7 +773,7 @@ void Graphics::draw_frame() {
         &wait_semaphores[0],            // Wait semaphores
         wait_stages.data(),             // Wait stages
         1,                              // Command buffer count
-        &commandBuffers[image_index],   // Command buffers
+        &commandBuffers[current_frame], // Command buffers
         signal_semaphores.size(),       // Signal semaphores count
         &signal_semaphores[0]           // Signal semaphores
     );
@@ -802,11 +798,13 @@ void Graphics::draw_frame() {
     }
 
     current_frame = (current_frame + 1) % MAX_CONCURRENT_FRAMES;
+    ++frame_number;
     
 }
 
 void Graphics::recreate_swapchain() {
     device.waitIdle();
+    memoryManager.flush_frees();
 
     clean_up_swapchain();
 
@@ -844,16 +842,15 @@ Graphics::~Graphics() {
     device.destroyDescriptorPool(descriptorPool);
     device.destroyDescriptorSetLayout(descriptorSetLayout);
 
-    device.destroyImage(textureImage);
-    device.freeMemory(textureImageMemory);
-
-
+    textureStreamer.destroy();
+    transferQueue.destroy();
     memoryManager.destroy();
     for (auto &sync_objects : frameSyncObjects) {
         device.destroyFence(sync_objects.inFlightFence);
         device.destroySemaphore(sync_objects.imageAvailableSemaphore);
         device.destroySemaphore(sync_objects.renderFinishedSemaphore);
     }
+    device.destroyCommandPool(transferCommandPool);
     device.destroyCommandPool(commandPool);
     instance.destroySurfaceKHR(surface);
 
@@ -882,6 +879,23 @@ void Graphics::start() {
     device.waitIdle();
 }
 
+void Graphics::dump_memory_statistics(const std::string &filename) {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file " + filename);
+    }
+    memoryManager.dump_statistics(file);
+    std::cout << "Wrote memory statistics to " << filename << std::endl;
+}
+
+void Graphics::toggle_allocation_trace(const std::string &filename) {
+    if (memoryManager.is_tracing()) {
+        memoryManager.stop_trace();
+    } else {
+        memoryManager.start_trace(filename);
+    }
+}
+
 void Graphics::close() {
     glfwSetWindowShouldClose(window, (int)true);
 }
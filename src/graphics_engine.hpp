@@ -3,7 +3,10 @@
 
 #include "includes.hpp"
 #include "vulkan_memory.hpp"
+#include "vulkan_transfer.hpp"
+#include "texture_streamer.hpp"
 #include "vulkan_helper.hpp"
+#include "util/asset_pack.hpp"
 #include <algorithm>
 #include <functional>
 #include <unordered_map>
@@ -46,6 +49,11 @@ class Graphics {
 
         void close();
 
+        // Writes per memory type and heap usage as JSON
+        void dump_memory_statistics(const std::string &filename);
+        // Starts an allocation trace, or stops the one running
+        void toggle_allocation_trace(const std::string &filename);
+
         // Forbid copy
         Graphics(const Graphics&) = delete;
 
@@ -102,6 +110,8 @@ class Graphics {
         vk::Device device;
         uint32_t queue_family;
         vk::Queue queue;
+        uint32_t transfer_queue_family;
+        vk::Queue transfer_queue;
         vk::SurfaceKHR surface;
         
         vk::SwapchainKHR swapchain;
@@ -113,29 +123,36 @@ class Graphics {
 
         vk::DescriptorPool descriptorPool;
         vk::DescriptorSetLayout descriptorSetLayout;
-        std::vector<vk::DescriptorSet> descriptorSets;
+        vk::DescriptorSet descriptorSet;
 
         vk::PipelineLayout pipelineLayout;
         vk::Pipeline graphicsPipeline;
 
         std::vector<vk::Framebuffer> swapChainFrameBuffers;
         vk::CommandPool commandPool;
+        vk::CommandPool transferCommandPool;
         std::vector<vk::CommandBuffer> commandBuffers;
 
         std::vector<FrameSyncObjects> frameSyncObjects;
         size_t current_frame = 0;
+        uint64_t frame_number = 0;
 
         vk_mem::Manager memoryManager;
+        vk_mem::TransferQueue transferQueue;
         vk_mem::BufferHandle vertexBuffer;
         vk_mem::BufferHandle indexBuffer;
-        std::vector<vk_mem::BufferHandle> uniformBuffers;
-        
-        // TODO move to memory manager
-        vk::Image textureImage;
-        vk::DeviceMemory textureImageMemory;
+        vk_mem::FrameRing uniformRing;
+        vk_mem::TextureStreamer textureStreamer;
+        vk_mem::TextureHandle texture;
+
+        // Mapped for the lifetime of the engine, loose files are used for anything it lacks
+        asset_pack::Reader assetPack;
 
 
         void check_support();
+        void open_asset_pack();
+        bool has_asset(const std::string &name);
+        vk::ShaderModule load_shader(const std::string &name);
         void create_instance();
         void pick_physical_device();
         void pick_queue_family();
@@ -155,12 +172,13 @@ class Graphics {
         void create_descriptor_pool();
         void create_descriptor_set();
         void create_command_buffers();
+        void record_command_buffer(uint32_t image_index, uint32_t uniform_offset);
         void create_sync_objects();
 
         void recreate_swapchain();
         void clean_up_swapchain();
 
-        void update_uniform_buffers(uint32_t image_index);
+        uint32_t update_uniform_buffers();
         void draw_frame();
         virtual void loop() = 0;
 };
@@ -0,0 +1,153 @@
+#include "image_ops.hpp"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace image_ops {
+
+    uint32_t mip_levels(const uint32_t width, const uint32_t height) {
+        uint32_t levels = 1;
+        for (uint32_t extent = std::max(width, height); extent > 1; extent /= 2) {
+            ++levels;
+        }
+        return levels;
+    }
+
+    uint32_t mip_extent(const uint32_t extent, const uint32_t level) {
+        return std::max(1u, extent >> level);
+    }
+
+    size_t mip_chain_size(const uint32_t width, const uint32_t height, const uint32_t level_count, const uint32_t first_level, const uint32_t pixel_size) {
+        size_t size = 0;
+        for (uint32_t level = first_level; level < level_count; level++) {
+            size += (size_t)mip_extent(width, level) * mip_extent(height, level) * pixel_size;
+        }
+        return size;
+    }
+
+    inline void box_pixel(const uint8_t *row0, const uint8_t *row1, const uint32_t x0, const uint32_t x1, uint8_t *dst) {
+        for (uint32_t c = 0; c < 4; c++) {
+            dst[c] = (uint8_t)((row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c] + 2) >> 2);
+        }
+    }
+
+    void box_downsample_scalar(const uint8_t *src, const uint32_t width, const uint32_t height, uint8_t *dst) {
+        uint32_t dst_width = std::max(1u, width / 2);
+        uint32_t dst_height = std::max(1u, height / 2);
+
+        for (uint32_t y = 0; y < dst_height; y++) {
+            const uint8_t *row0 = src + (size_t)std::min(2 * y, height - 1) * width * 4;
+            const uint8_t *row1 = src + (size_t)std::min(2 * y + 1, height - 1) * width * 4;
+            uint8_t *out = dst + (size_t)y * dst_width * 4;
+            for (uint32_t x = 0; x < dst_width; x++) {
+                box_pixel(row0, row1, std::min(2 * x, width - 1), std::min(2 * x + 1, width - 1), out + x * 4);
+            }
+        }
+    }
+
+    void box_downsample(const uint8_t *src, const uint32_t width, const uint32_t height, uint8_t *dst) {
+        #ifdef __SSE2__
+        uint32_t dst_width = std::max(1u, width / 2);
+        uint32_t dst_height = std::max(1u, height / 2);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i rounding = _mm_set1_epi16(2);
+
+        for (uint32_t y = 0; y < dst_height; y++) {
+            const uint8_t *row0 = src + (size_t)std::min(2 * y, height - 1) * width * 4;
+            const uint8_t *row1 = src + (size_t)std::min(2 * y + 1, height - 1) * width * 4;
+            uint8_t *out = dst + (size_t)y * dst_width * 4;
+
+            // Four output pixels from eight source pixels of each row
+            uint32_t x = 0;
+            for (; 2 * x + 8 <= width && x + 4 <= dst_width; x += 4) {
+                __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+                __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8 + 16));
+                __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+                __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8 + 16));
+
+                // Vertical sums in 16 bit, two pixels per register
+                __m128i p01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+                __m128i p23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+                __m128i p45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+                __m128i p67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+                // Horizontal sums of neighbouring pixels
+                __m128i q01 = _mm_add_epi16(_mm_unpacklo_epi64(p01, p23), _mm_unpackhi_epi64(p01, p23));
+                __m128i q23 = _mm_add_epi16(_mm_unpacklo_epi64(p45, p67), _mm_unpackhi_epi64(p45, p67));
+
+                q01 = _mm_srli_epi16(_mm_add_epi16(q01, rounding), 2);
+                q23 = _mm_srli_epi16(_mm_add_epi16(q23, rounding), 2);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(q01, q23));
+            }
+            for (; x < dst_width; x++) {
+                box_pixel(row0, row1, std::min(2 * x, width - 1), std::min(2 * x + 1, width - 1), out + x * 4);
+            }
+        }
+        #else
+        box_downsample_scalar(src, width, height, dst);
+        #endif
+    }
+
+    void generate_mip_chain(const uint8_t *src, const uint32_t width, const uint32_t height, const uint32_t level_count, uint8_t *dst) {
+        const uint8_t *previous = src;
+        for (uint32_t level = 1; level < level_count; level++) {
+            box_downsample(previous, mip_extent(width, level - 1), mip_extent(height, level - 1), dst);
+            previous = dst;
+            dst += (size_t)mip_extent(width, level) * mip_extent(height, level) * 4;
+        }
+    }
+
+    void box_downsample_float_scalar(const float *src, const uint32_t width, const uint32_t height, float *dst) {
+        uint32_t dst_width = std::max(1u, width / 2);
+        uint32_t dst_height = std::max(1u, height / 2);
+
+        for (uint32_t y = 0; y < dst_height; y++) {
+            const float *row0 = src + (size_t)std::min(2 * y, height - 1) * width * 4;
+            const float *row1 = src + (size_t)std::min(2 * y + 1, height - 1) * width * 4;
+            float *out = dst + (size_t)y * dst_width * 4;
+            for (uint32_t x = 0; x < dst_width; x++) {
+                uint32_t x0 = std::min(2 * x, width - 1) * 4;
+                uint32_t x1 = std::min(2 * x + 1, width - 1) * 4;
+                for (uint32_t c = 0; c < 4; c++) {
+                    out[x * 4 + c] = ((row0[x0 + c] + row0[x1 + c]) + (row1[x0 + c] + row1[x1 + c])) * 0.25f;
+                }
+            }
+        }
+    }
+
+    void box_downsample_float(const float *src, const uint32_t width, const uint32_t height, float *dst) {
+        #ifdef __SSE2__
+        uint32_t dst_width = std::max(1u, width / 2);
+        uint32_t dst_height = std::max(1u, height / 2);
+        const __m128 quarter = _mm_set1_ps(0.25f);
+
+        // A pixel fills a register, so edges only change which pixels are loaded
+        for (uint32_t y = 0; y < dst_height; y++) {
+            const float *row0 = src + (size_t)std::min(2 * y, height - 1) * width * 4;
+            const float *row1 = src + (size_t)std::min(2 * y + 1, height - 1) * width * 4;
+            float *out = dst + (size_t)y * dst_width * 4;
+            for (uint32_t x = 0; x < dst_width; x++) {
+                uint32_t x0 = std::min(2 * x, width - 1) * 4;
+                uint32_t x1 = std::min(2 * x + 1, width - 1) * 4;
+                __m128 top = _mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1));
+                __m128 bottom = _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1));
+                _mm_storeu_ps(out + x * 4, _mm_mul_ps(_mm_add_ps(top, bottom), quarter));
+            }
+        }
+        #else
+        box_downsample_float_scalar(src, width, height, dst);
+        #endif
+    }
+
+    void generate_mip_chain_float(const float *src, const uint32_t width, const uint32_t height, const uint32_t level_count, float *dst) {
+        const float *previous = src;
+        for (uint32_t level = 1; level < level_count; level++) {
+            box_downsample_float(previous, mip_extent(width, level - 1), mip_extent(height, level - 1), dst);
+            previous = dst;
+            dst += (size_t)mip_extent(width, level) * mip_extent(height, level) * 4;
+        }
+    }
+
+}
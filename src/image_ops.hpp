@@ -0,0 +1,39 @@
+/*
+CPU image operations on tightly packed RGBA8 or RGBA32F pixels.
+
+Used when a format cannot be blitted with linear filtering, so mip levels have to be
+generated before the upload. Kernels have an SSE2 path and a scalar fallback.
+*/
+
+#ifndef IMAGE_OPS_HPP
+#define IMAGE_OPS_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace image_ops {
+
+    // Levels of a full chain down to 1x1
+    uint32_t mip_levels(const uint32_t width, const uint32_t height);
+    uint32_t mip_extent(const uint32_t extent, const uint32_t level);
+    // Bytes of levels [first_level, level_count) packed one after another
+    size_t mip_chain_size(const uint32_t width, const uint32_t height, const uint32_t level_count, const uint32_t first_level = 0, const uint32_t pixel_size = 4);
+
+    /**
+     * Averages 2x2 blocks of src into dst, which is max(1, width / 2) by max(1, height / 2).
+     * The last row and column are repeated when a dimension is odd.
+     */
+    void box_downsample(const uint8_t *src, const uint32_t width, const uint32_t height, uint8_t *dst);
+    void box_downsample_scalar(const uint8_t *src, const uint32_t width, const uint32_t height, uint8_t *dst);
+
+    // Writes levels 1 to level_count - 1 of src into dst, packed like mip_chain_size(width, height, level_count, 1)
+    void generate_mip_chain(const uint8_t *src, const uint32_t width, const uint32_t height, const uint32_t level_count, uint8_t *dst);
+
+    // The same on RGBA32F pixels, for HDR sources that are converted after filtering
+    void box_downsample_float(const float *src, const uint32_t width, const uint32_t height, float *dst);
+    void box_downsample_float_scalar(const float *src, const uint32_t width, const uint32_t height, float *dst);
+    void generate_mip_chain_float(const float *src, const uint32_t width, const uint32_t height, const uint32_t level_count, float *dst);
+
+}
+
+#endif // IMAGE_OPS_HPP
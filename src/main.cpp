@@ -34,6 +34,14 @@ int main() {
         app.close();
     });
 
+    app.addKeyCallback(GLFW_KEY_F2, GLFW_PRESS, 0, [&app](){
+        app.dump_memory_statistics("memory_stats.json");
+    });
+
+    app.addKeyCallback(GLFW_KEY_F3, GLFW_PRESS, 0, [&app](){
+        app.toggle_allocation_trace("alloc_trace.bin");
+    });
+
     app.addMouseCallback(GLFW_MOUSE_BUTTON_LEFT, GLFW_PRESS, 0, [](double x, double y){
         std::cout << "Click: " << x << ", " << y << std::endl;
     });
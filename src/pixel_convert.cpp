@@ -0,0 +1,325 @@
+#include "pixel_convert.hpp"
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+namespace pixel_convert {
+
+    void expand_rgb_to_rgba_scalar(const uint8_t *src, const size_t count, uint8_t *dst) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i * 4] = src[i * 3];
+            dst[i * 4 + 1] = src[i * 3 + 1];
+            dst[i * 4 + 2] = src[i * 3 + 2];
+            dst[i * 4 + 3] = 255;
+        }
+    }
+
+    void expand_rgb_to_rgba(const uint8_t *src, const size_t count, uint8_t *dst) {
+        size_t i = 0;
+        // Loads are 16 bytes wide for 12 bytes of pixels, so they stop short of the end
+        #ifdef __AVX2__
+        const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m256i opaque = _mm256_set1_epi32((int)0xFF000000);
+        for (; (i + 8) * 3 + 4 <= count * 3; i += 8) {
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+            __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3 + 12));
+            __m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(pixels, spread), opaque));
+        }
+        #endif
+        #ifdef __SSE4_1__
+        const __m128i spread4 = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i opaque4 = _mm_set1_epi32((int)0xFF000000);
+        for (; (i + 4) * 3 + 4 <= count * 3; i += 4) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(pixels, spread4), opaque4));
+        }
+        #endif
+        expand_rgb_to_rgba_scalar(src + i * 3, count - i, dst + i * 4);
+    }
+
+    // x / 255 rounded, exact for x up to 255 * 255
+    inline uint32_t divide_255(const uint32_t x) {
+        uint32_t t = x + 128;
+        return (t + (t >> 8)) >> 8;
+    }
+
+    void premultiply_alpha_scalar(const uint8_t *src, const size_t count, uint8_t *dst) {
+        for (size_t i = 0; i < count; i++) {
+            uint32_t alpha = src[i * 4 + 3];
+            dst[i * 4] = (uint8_t)divide_255(src[i * 4] * alpha);
+            dst[i * 4 + 1] = (uint8_t)divide_255(src[i * 4 + 1] * alpha);
+            dst[i * 4 + 2] = (uint8_t)divide_255(src[i * 4 + 2] * alpha);
+            dst[i * 4 + 3] = (uint8_t)alpha;
+        }
+    }
+
+    // Alpha of each 16 bit pixel in all four channels, except 255 in the alpha channel so it stays as is
+    #define PREMULTIPLY_ALPHA_LANES 6, 7, 6, 7, 6, 7, -1, -1, 14, 15, 14, 15, 14, 15, -1, -1
+
+    void premultiply_alpha(const uint8_t *src, const size_t count, uint8_t *dst) {
+        size_t i = 0;
+        #ifdef __AVX2__
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i alpha_lanes = _mm256_setr_epi8(PREMULTIPLY_ALPHA_LANES, PREMULTIPLY_ALPHA_LANES);
+            const __m256i keep_alpha = _mm256_set1_epi64x(0x00FF000000000000);
+            const __m256i rounding = _mm256_set1_epi16(128);
+            auto multiply = [&](__m256i pixels) {
+                __m256i alpha = _mm256_or_si256(_mm256_shuffle_epi8(pixels, alpha_lanes), keep_alpha);
+                __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(pixels, alpha), rounding);
+                return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+            };
+            for (; i + 8 <= count; i += 8) {
+                __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+                __m256i lo = multiply(_mm256_unpacklo_epi8(pixels, zero));
+                __m256i hi = multiply(_mm256_unpackhi_epi8(pixels, zero));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_packus_epi16(lo, hi));
+            }
+        }
+        #endif
+        #ifdef __SSE4_1__
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i alpha_lanes = _mm_setr_epi8(PREMULTIPLY_ALPHA_LANES);
+            const __m128i keep_alpha = _mm_set1_epi64x(0x00FF000000000000);
+            const __m128i rounding = _mm_set1_epi16(128);
+            auto multiply = [&](__m128i pixels) {
+                __m128i alpha = _mm_or_si128(_mm_shuffle_epi8(pixels, alpha_lanes), keep_alpha);
+                __m128i t = _mm_add_epi16(_mm_mullo_epi16(pixels, alpha), rounding);
+                return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+            };
+            for (; i + 4 <= count; i += 4) {
+                __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+                __m128i lo = multiply(_mm_unpacklo_epi8(pixels, zero));
+                __m128i hi = multiply(_mm_unpackhi_epi8(pixels, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_packus_epi16(lo, hi));
+            }
+        }
+        #endif
+        premultiply_alpha_scalar(src + i * 4, count - i, dst + i * 4);
+    }
+
+    #undef PREMULTIPLY_ALPHA_LANES
+
+    /*
+    Rounding is done on the float bits: normal results add half a unit minus one plus the
+    lowest kept bit before truncating, which rounds to nearest even. Results below the
+    smallest normal half are made by adding 0.5, which lines the half subnormal up with
+    the low float mantissa bits and lets the FPU round.
+    */
+    inline uint16_t half_from_float(const float value) {
+        uint32_t x;
+        memcpy(&x, &value, sizeof(x));
+        uint32_t sign = (x >> 16) & 0x8000;
+        x &= 0x7FFFFFFF;
+
+        uint32_t half;
+        if (x >= 0x477FF000) {
+            // Rounds to infinity or is infinity or NaN
+            half = x > 0x7F800000 ? 0x7E00 : 0x7C00;
+        } else if (x < 0x38800000) {
+            float shifted;
+            memcpy(&shifted, &x, sizeof(shifted));
+            shifted += 0.5f;
+            memcpy(&half, &shifted, sizeof(half));
+            half -= 0x3F000000;
+        } else {
+            half = (x + 0xC8000FFF + ((x >> 13) & 1)) >> 13;
+        }
+        return (uint16_t)(half | sign);
+    }
+
+    void float_to_half_scalar(const float *src, const size_t count, uint16_t *dst) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = half_from_float(src[i]);
+        }
+    }
+
+    #ifdef __SSE4_1__
+    // half_from_float on four floats, the results are in the low 16 bits of each lane
+    inline __m128i half_from_float4(const __m128 value) {
+        __m128i x = _mm_castps_si128(value);
+        __m128i sign = _mm_srli_epi32(_mm_and_si128(x, _mm_set1_epi32((int)0x80000000)), 16);
+        x = _mm_and_si128(x, _mm_set1_epi32(0x7FFFFFFF));
+
+        __m128i nan = _mm_cmpgt_epi32(x, _mm_set1_epi32(0x7F800000));
+        __m128i special = _mm_or_si128(_mm_set1_epi32(0x7C00), _mm_and_si128(nan, _mm_set1_epi32(0x0200)));
+        __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(x), _mm_set1_ps(0.5f))), _mm_set1_epi32(0x3F000000));
+        __m128i odd = _mm_and_si128(_mm_srli_epi32(x, 13), _mm_set1_epi32(1));
+        __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(x, _mm_set1_epi32((int)0xC8000FFF)), odd), 13);
+
+        __m128i half = _mm_blendv_epi8(normal, subnormal, _mm_cmplt_epi32(x, _mm_set1_epi32(0x38800000)));
+        half = _mm_blendv_epi8(half, special, _mm_cmpgt_epi32(x, _mm_set1_epi32(0x477FEFFF)));
+        return _mm_or_si128(half, sign);
+    }
+    #endif
+
+    void float_to_half(const float *src, const size_t count, uint16_t *dst) {
+        size_t i = 0;
+        // F16C comes with every AVX2 processor and converts in one instruction
+        #ifdef __F16C__
+        for (; i + 8 <= count; i += 8) {
+            __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), half);
+        }
+        #endif
+        #ifdef __SSE4_1__
+        for (; i + 8 <= count; i += 8) {
+            __m128i lo = half_from_float4(_mm_loadu_ps(src + i));
+            __m128i hi = half_from_float4(_mm_loadu_ps(src + i + 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi32(lo, hi));
+        }
+        #endif
+        float_to_half_scalar(src + i, count - i, dst + i);
+    }
+
+    void unorm16_to_float_scalar(const uint16_t *src, const size_t count, float *dst) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = src[i] * (1.0f / 65535.0f);
+        }
+    }
+
+    void unorm16_to_float(const uint16_t *src, const size_t count, float *dst) {
+        size_t i = 0;
+        #ifdef __AVX2__
+        const __m256 scale = _mm256_set1_ps(1.0f / 65535.0f);
+        for (; i + 8 <= count; i += 8) {
+            __m256i values = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(values), scale));
+        }
+        #endif
+        #ifdef __SSE4_1__
+        const __m128 scale4 = _mm_set1_ps(1.0f / 65535.0f);
+        for (; i + 4 <= count; i += 4) {
+            __m128i values = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+            _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(values), scale4));
+        }
+        #endif
+        unorm16_to_float_scalar(src + i, count - i, dst + i);
+    }
+
+    // Unsigned 11 and 10 bit floats have the exponent of a half and 6 or 5 mantissa bits, rounded like half_from_float
+    inline uint32_t packed_float_from_float(const float value, const uint32_t mantissa_bits) {
+        uint32_t x;
+        memcpy(&x, &value, sizeof(x));
+        uint32_t shift = 23 - mantissa_bits;
+
+        if ((int32_t)x <= 0 || x > 0x7F800000) {
+            // Zero, negative or NaN
+            return 0;
+        } else if (x >= 0x47800000 - (1u << (shift - 1))) {
+            return (0x1E << mantissa_bits) | ((1u << mantissa_bits) - 1);
+        } else if (x < 0x38800000) {
+            uint32_t magic_bits = (136 - mantissa_bits) << 23;
+            float magic, shifted;
+            memcpy(&magic, &magic_bits, sizeof(magic));
+            memcpy(&shifted, &x, sizeof(shifted));
+            shifted += magic;
+            uint32_t bits;
+            memcpy(&bits, &shifted, sizeof(bits));
+            return bits - magic_bits;
+        }
+        return (x + 0xC8000000 + (1u << (shift - 1)) - 1 + ((x >> shift) & 1)) >> shift;
+    }
+
+    void float_to_b10g11r11_scalar(const float *src, const size_t count, uint32_t *dst) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = packed_float_from_float(src[i * 4], 6)
+                | packed_float_from_float(src[i * 4 + 1], 6) << 11
+                | packed_float_from_float(src[i * 4 + 2], 5) << 22;
+        }
+    }
+
+    /*
+    packed_float_from_float with the channel's constants in each lane. There is no variable
+    shift before AVX2, so every lane shifts by 17 and blue, rounded at bit 18, keeps a zero
+    below its 5 mantissa bits. Blue stays doubled until the lanes are multiplied into place.
+    */
+    #define PACKED_FLOAT_THRESHOLD 0x477EFFFF, 0x477EFFFF, 0x477DFFFF, 0x7FFFFFFF
+    #define PACKED_FLOAT_SATURATED 0x7BF, 0x7BF, 0x7BE, 0
+    #define PACKED_FLOAT_MAGIC 0x41000000, 0x41000000, 0x41800000, 0x41000000
+    #define PACKED_FLOAT_ADJUST (int)0xC800FFFF, (int)0xC800FFFF, (int)0xC801FFFF, 0
+    #define PACKED_FLOAT_KEEP (int)0xFFFE0000, (int)0xFFFE0000, (int)0xFFFC0000, 0
+    #define PACKED_FLOAT_ODD 1, 1, 2, 0
+    #define PACKED_FLOAT_BLUE 0, 0, -1, 0
+    #define PACKED_FLOAT_PLACE 1, 1 << 11, 1 << 21, 0
+
+    #ifdef __AVX2__
+    // Two pixels, each lane holds its channel in place with alpha 0
+    inline __m256i packed_float_lanes8(const __m256 value) {
+        __m256i x = _mm256_max_epi32(_mm256_castps_si256(value), _mm256_setzero_si256());
+        __m256i magic = _mm256_setr_epi32(PACKED_FLOAT_MAGIC, PACKED_FLOAT_MAGIC);
+        __m256i subnormal = _mm256_sub_epi32(_mm256_castps_si256(_mm256_add_ps(_mm256_castsi256_ps(x), _mm256_castsi256_ps(magic))), magic);
+        subnormal = _mm256_add_epi32(subnormal, _mm256_and_si256(subnormal, _mm256_setr_epi32(PACKED_FLOAT_BLUE, PACKED_FLOAT_BLUE)));
+        __m256i odd = _mm256_min_epu32(_mm256_and_si256(_mm256_srli_epi32(x, 17), _mm256_setr_epi32(PACKED_FLOAT_ODD, PACKED_FLOAT_ODD)), _mm256_set1_epi32(1));
+        __m256i normal = _mm256_add_epi32(_mm256_add_epi32(x, _mm256_setr_epi32(PACKED_FLOAT_ADJUST, PACKED_FLOAT_ADJUST)), odd);
+        normal = _mm256_srli_epi32(_mm256_and_si256(normal, _mm256_setr_epi32(PACKED_FLOAT_KEEP, PACKED_FLOAT_KEEP)), 17);
+
+        __m256i packed = _mm256_blendv_epi8(normal, subnormal, _mm256_cmpgt_epi32(_mm256_set1_epi32(0x38800000), x));
+        packed = _mm256_blendv_epi8(packed, _mm256_setr_epi32(PACKED_FLOAT_SATURATED, PACKED_FLOAT_SATURATED),
+            _mm256_cmpgt_epi32(x, _mm256_setr_epi32(PACKED_FLOAT_THRESHOLD, PACKED_FLOAT_THRESHOLD)));
+        packed = _mm256_andnot_si256(_mm256_cmpgt_epi32(x, _mm256_set1_epi32(0x7F800000)), packed);
+        return _mm256_mullo_epi32(packed, _mm256_setr_epi32(PACKED_FLOAT_PLACE, PACKED_FLOAT_PLACE));
+    }
+    #endif
+
+    #ifdef __SSE4_1__
+    inline __m128i packed_float_lanes(const __m128 value) {
+        __m128i x = _mm_max_epi32(_mm_castps_si128(value), _mm_setzero_si128());
+        __m128i magic = _mm_setr_epi32(PACKED_FLOAT_MAGIC);
+        __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(x), _mm_castsi128_ps(magic))), magic);
+        subnormal = _mm_add_epi32(subnormal, _mm_and_si128(subnormal, _mm_setr_epi32(PACKED_FLOAT_BLUE)));
+        __m128i odd = _mm_min_epu32(_mm_and_si128(_mm_srli_epi32(x, 17), _mm_setr_epi32(PACKED_FLOAT_ODD)), _mm_set1_epi32(1));
+        __m128i normal = _mm_add_epi32(_mm_add_epi32(x, _mm_setr_epi32(PACKED_FLOAT_ADJUST)), odd);
+        normal = _mm_srli_epi32(_mm_and_si128(normal, _mm_setr_epi32(PACKED_FLOAT_KEEP)), 17);
+
+        __m128i packed = _mm_blendv_epi8(normal, subnormal, _mm_cmplt_epi32(x, _mm_set1_epi32(0x38800000)));
+        packed = _mm_blendv_epi8(packed, _mm_setr_epi32(PACKED_FLOAT_SATURATED), _mm_cmpgt_epi32(x, _mm_setr_epi32(PACKED_FLOAT_THRESHOLD)));
+        packed = _mm_andnot_si128(_mm_cmpgt_epi32(x, _mm_set1_epi32(0x7F800000)), packed);
+        return _mm_mullo_epi32(packed, _mm_setr_epi32(PACKED_FLOAT_PLACE));
+    }
+    #endif
+
+    void float_to_b10g11r11(const float *src, const size_t count, uint32_t *dst) {
+        size_t i = 0;
+        // The channels of a pixel are in disjoint bits, so horizontal adds combine them
+        #ifdef __AVX2__
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        for (; i + 8 <= count; i += 8) {
+            __m256i p01 = packed_float_lanes8(_mm256_loadu_ps(src + i * 4));
+            __m256i p23 = packed_float_lanes8(_mm256_loadu_ps(src + i * 4 + 8));
+            __m256i p45 = packed_float_lanes8(_mm256_loadu_ps(src + i * 4 + 16));
+            __m256i p67 = packed_float_lanes8(_mm256_loadu_ps(src + i * 4 + 24));
+            // Even pixels end up in the low half, odd ones in the high half
+            __m256i pixels = _mm256_hadd_epi32(_mm256_hadd_epi32(p01, p23), _mm256_hadd_epi32(p45, p67));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permutevar8x32_epi32(pixels, order));
+        }
+        #endif
+        #ifdef __SSE4_1__
+        for (; i + 4 <= count; i += 4) {
+            __m128i p0 = packed_float_lanes(_mm_loadu_ps(src + i * 4));
+            __m128i p1 = packed_float_lanes(_mm_loadu_ps(src + i * 4 + 4));
+            __m128i p2 = packed_float_lanes(_mm_loadu_ps(src + i * 4 + 8));
+            __m128i p3 = packed_float_lanes(_mm_loadu_ps(src + i * 4 + 12));
+            __m128i pixels = _mm_hadd_epi32(_mm_hadd_epi32(p0, p1), _mm_hadd_epi32(p2, p3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), pixels);
+        }
+        #endif
+        float_to_b10g11r11_scalar(src + i * 4, count - i, dst + i);
+    }
+
+    #undef PACKED_FLOAT_THRESHOLD
+    #undef PACKED_FLOAT_SATURATED
+    #undef PACKED_FLOAT_MAGIC
+    #undef PACKED_FLOAT_ADJUST
+    #undef PACKED_FLOAT_KEEP
+    #undef PACKED_FLOAT_ODD
+    #undef PACKED_FLOAT_BLUE
+    #undef PACKED_FLOAT_PLACE
+
+}
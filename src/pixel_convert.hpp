@@ -0,0 +1,44 @@
+/*
+CPU pixel format conversion for texture ingestion.
+
+Kernels work on count pixels of tightly packed data and take src and dst separately,
+they may be the same buffer when both have the same pixel size. They have AVX2 and
+SSE4.1 paths, F16C for half floats, and a scalar fallback. The widest one enabled at
+compile time is used, the scalar versions are exported to check the others against.
+*/
+
+#ifndef PIXEL_CONVERT_HPP
+#define PIXEL_CONVERT_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace pixel_convert {
+
+    // RGB8 to RGBA8 with opaque alpha
+    void expand_rgb_to_rgba(const uint8_t *src, const size_t count, uint8_t *dst);
+    void expand_rgb_to_rgba_scalar(const uint8_t *src, const size_t count, uint8_t *dst);
+
+    // Multiplies the colour of RGBA8 pixels by their alpha, rounded to nearest
+    void premultiply_alpha(const uint8_t *src, const size_t count, uint8_t *dst);
+    void premultiply_alpha_scalar(const uint8_t *src, const size_t count, uint8_t *dst);
+
+    // count floats to IEEE half floats, rounded to nearest even, out of range values become infinity
+    void float_to_half(const float *src, const size_t count, uint16_t *dst);
+    void float_to_half_scalar(const float *src, const size_t count, uint16_t *dst);
+
+    // count 16 bit unsigned normalized values to floats in [0, 1]
+    void unorm16_to_float(const uint16_t *src, const size_t count, float *dst);
+    void unorm16_to_float_scalar(const uint16_t *src, const size_t count, float *dst);
+
+    /**
+     * RGBA32F to B10G11R11_UFLOAT_PACK32, alpha is dropped. Rounded to nearest even, negative
+     * values and NaN become 0 and values past the largest finite one saturate to it, so HDR
+     * data never samples as infinity.
+     */
+    void float_to_b10g11r11(const float *src, const size_t count, uint32_t *dst);
+    void float_to_b10g11r11_scalar(const float *src, const size_t count, uint32_t *dst);
+
+}
+
+#endif // PIXEL_CONVERT_HPP
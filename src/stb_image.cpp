@@ -1,2 +1,4 @@
+// Failure reasons are per thread, texture streamer workers decode concurrently
+#define STBI_THREAD_LOCAL thread_local
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
\ No newline at end of file
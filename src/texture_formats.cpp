@@ -0,0 +1,266 @@
+#include "texture_formats.hpp"
+#include "image_ops.hpp"
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+namespace vk_help {
+
+    format_block get_format_block(const vk::Format &format) {
+        switch (format) {
+            case vk::Format::eR8G8B8A8Unorm:
+            case vk::Format::eR8G8B8A8Srgb:
+            case vk::Format::eB8G8R8A8Unorm:
+            case vk::Format::eB8G8R8A8Srgb:
+            case vk::Format::eB10G11R11UfloatPack32:
+                return format_block {1, 1, 4};
+            case vk::Format::eR16G16B16A16Sfloat:
+                return format_block {1, 1, 8};
+            case vk::Format::eR32G32B32A32Sfloat:
+                return format_block {1, 1, 16};
+            case vk::Format::eBc1RgbUnormBlock:
+            case vk::Format::eBc1RgbSrgbBlock:
+            case vk::Format::eBc1RgbaUnormBlock:
+            case vk::Format::eBc1RgbaSrgbBlock:
+            case vk::Format::eBc4UnormBlock:
+            case vk::Format::eBc4SnormBlock:
+            case vk::Format::eEtc2R8G8B8UnormBlock:
+            case vk::Format::eEtc2R8G8B8SrgbBlock:
+            case vk::Format::eEtc2R8G8B8A1UnormBlock:
+            case vk::Format::eEtc2R8G8B8A1SrgbBlock:
+            case vk::Format::eEacR11UnormBlock:
+            case vk::Format::eEacR11SnormBlock:
+                return format_block {4, 4, 8};
+            case vk::Format::eBc2UnormBlock:
+            case vk::Format::eBc2SrgbBlock:
+            case vk::Format::eBc3UnormBlock:
+            case vk::Format::eBc3SrgbBlock:
+            case vk::Format::eBc5UnormBlock:
+            case vk::Format::eBc5SnormBlock:
+            case vk::Format::eBc6HUfloatBlock:
+            case vk::Format::eBc6HSfloatBlock:
+            case vk::Format::eBc7UnormBlock:
+            case vk::Format::eBc7SrgbBlock:
+            case vk::Format::eEtc2R8G8B8A8UnormBlock:
+            case vk::Format::eEtc2R8G8B8A8SrgbBlock:
+            case vk::Format::eEacR11G11UnormBlock:
+            case vk::Format::eEacR11G11SnormBlock:
+                return format_block {4, 4, 16};
+            default:
+                throw std::runtime_error("Unsupported texture format " + std::to_string((uint32_t)format));
+        }
+    }
+
+    bool is_block_compressed(const vk::Format &format) {
+        return get_format_block(format).width > 1;
+    }
+
+    vk::DeviceSize get_level_size(const vk::Format &format, uint32_t width, uint32_t height, uint32_t level) {
+        format_block block = get_format_block(format);
+        vk::DeviceSize blocks_x = (std::max(1u, width >> level) + block.width - 1) / block.width;
+        vk::DeviceSize blocks_y = (std::max(1u, height >> level) + block.height - 1) / block.height;
+        return blocks_x * blocks_y * block.bytes;
+    }
+
+    template<typename T>
+    T read_value(const char *data, const size_t size, const size_t offset) {
+        if (offset + sizeof(T) > size) {
+            throw std::runtime_error("Texture file is truncated");
+        }
+        T value;
+        memcpy(&value, data + offset, sizeof(T));
+        return value;
+    }
+
+    void check_extent(const uint32_t width, const uint32_t height, const uint32_t level_count) {
+        if (width == 0 || height == 0 || level_count > image_ops::mip_levels(width, height)) {
+            throw std::runtime_error("Invalid texture extent or level count");
+        }
+    }
+
+    void check_levels(const texture_file &file, const size_t size) {
+        for (auto &level : file.levels) {
+            if (level.offset + level.size > size) {
+                throw std::runtime_error("Texture file is truncated");
+            }
+        }
+    }
+
+    std::string get_extension(const std::string &path) {
+        std::string extension = path.substr(path.find_last_of('.') + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        return extension;
+    }
+
+    bool is_texture_container(const std::string &path) {
+        std::string extension = get_extension(path);
+        return extension == "ktx2" || extension == "dds";
+    }
+
+    texture_file load_texture_file(const std::string &path) {
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open texture " + path);
+        }
+
+        std::vector<char> storage((size_t)file.tellg());
+        file.seekg(0);
+        file.read(storage.data(), storage.size());
+        file.close();
+
+        texture_file texture = parse_texture_file(storage.data(), storage.size());
+        // Moving the vector keeps its buffer, data stays valid
+        texture.storage = std::move(storage);
+        return texture;
+    }
+
+    static const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+    texture_file parse_texture_file(const char *data, const size_t size) {
+        if (size >= sizeof(KTX2_IDENTIFIER) && memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0) {
+            return parse_ktx2(data, size);
+        }
+        return parse_dds(data, size);
+    }
+
+    texture_file parse_ktx2(const char *data, const size_t size) {
+        if (size < 80 || memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {
+            throw std::runtime_error("Not a KTX2 file");
+        }
+
+        texture_file file;
+        file.format = (vk::Format)read_value<uint32_t>(data, size, 12);
+        file.width = read_value<uint32_t>(data, size, 20);
+        file.height = std::max(1u, read_value<uint32_t>(data, size, 24));
+        uint32_t depth = read_value<uint32_t>(data, size, 28);
+        uint32_t layers = read_value<uint32_t>(data, size, 32);
+        uint32_t faces = read_value<uint32_t>(data, size, 36);
+        uint32_t level_count = std::max(1u, read_value<uint32_t>(data, size, 40));
+        uint32_t supercompression = read_value<uint32_t>(data, size, 44);
+
+        if (depth > 1 || layers > 1 || faces != 1) {
+            throw std::runtime_error("Only single 2D KTX2 textures are supported");
+        }
+        if (supercompression != 0) {
+            throw std::runtime_error("Supercompressed KTX2 textures are not supported");
+        }
+        if (file.format == vk::Format::eUndefined) {
+            throw std::runtime_error("KTX2 textures without a Vulkan format are not supported");
+        }
+        check_extent(file.width, file.height, level_count);
+
+        // The level index follows the 80 byte header, level 0 first
+        for (uint32_t level = 0; level < level_count; level++) {
+            size_t entry = 80 + level * 24;
+            size_t offset = (size_t)read_value<uint64_t>(data, size, entry);
+            size_t level_size = (size_t)get_level_size(file.format, file.width, file.height, level);
+            if (read_value<uint64_t>(data, size, entry + 8) < level_size) {
+                throw std::runtime_error("KTX2 level is smaller than its format requires");
+            }
+            file.levels.push_back(texture_level {offset, level_size});
+        }
+
+        file.data = data;
+        check_levels(file, size);
+        return file;
+    }
+
+    constexpr uint32_t four_cc(const char (&code)[5]) {
+        return (uint32_t)code[0] | ((uint32_t)code[1] << 8) | ((uint32_t)code[2] << 16) | ((uint32_t)code[3] << 24);
+    }
+
+    vk::Format dxgi_format(const uint32_t format) {
+        switch (format) {
+            case 28: return vk::Format::eR8G8B8A8Unorm;
+            case 29: return vk::Format::eR8G8B8A8Srgb;
+            case 87: return vk::Format::eB8G8R8A8Unorm;
+            case 91: return vk::Format::eB8G8R8A8Srgb;
+            case 10: return vk::Format::eR16G16B16A16Sfloat;
+            case 26: return vk::Format::eB10G11R11UfloatPack32;
+            case 71: return vk::Format::eBc1RgbaUnormBlock;
+            case 72: return vk::Format::eBc1RgbaSrgbBlock;
+            case 74: return vk::Format::eBc2UnormBlock;
+            case 75: return vk::Format::eBc2SrgbBlock;
+            case 77: return vk::Format::eBc3UnormBlock;
+            case 78: return vk::Format::eBc3SrgbBlock;
+            case 80: return vk::Format::eBc4UnormBlock;
+            case 81: return vk::Format::eBc4SnormBlock;
+            case 83: return vk::Format::eBc5UnormBlock;
+            case 84: return vk::Format::eBc5SnormBlock;
+            case 95: return vk::Format::eBc6HUfloatBlock;
+            case 96: return vk::Format::eBc6HSfloatBlock;
+            case 98: return vk::Format::eBc7UnormBlock;
+            case 99: return vk::Format::eBc7SrgbBlock;
+            default:
+                throw std::runtime_error("Unsupported DXGI format " + std::to_string(format));
+        }
+    }
+
+    texture_file parse_dds(const char *data, const size_t size) {
+        if (size < 128 || read_value<uint32_t>(data, size, 0) != four_cc("DDS ")) {
+            throw std::runtime_error("Not a DDS file");
+        }
+
+        // DDS_HEADER starts after the magic, DDS_PIXELFORMAT at byte 76 of it
+        texture_file file;
+        file.height = read_value<uint32_t>(data, size, 12);
+        file.width = read_value<uint32_t>(data, size, 16);
+        uint32_t level_count = std::max(1u, read_value<uint32_t>(data, size, 28));
+        uint32_t pixel_flags = read_value<uint32_t>(data, size, 80);
+        uint32_t pixel_four_cc = read_value<uint32_t>(data, size, 84);
+        uint32_t caps2 = read_value<uint32_t>(data, size, 112);
+
+        if (caps2 & 0x200) {
+            throw std::runtime_error("DDS cube maps are not supported");
+        }
+        check_extent(file.width, file.height, level_count);
+
+        size_t data_offset = 128;
+        if (pixel_flags & 0x4) {
+            if (pixel_four_cc == four_cc("DX10")) {
+                file.format = dxgi_format(read_value<uint32_t>(data, size, 128));
+                if (read_value<uint32_t>(data, size, 140) > 1) {
+                    throw std::runtime_error("DDS texture arrays are not supported");
+                }
+                data_offset += 20;
+            } else if (pixel_four_cc == four_cc("DXT1")) {
+                file.format = vk::Format::eBc1RgbaUnormBlock;
+            } else if (pixel_four_cc == four_cc("DXT3")) {
+                file.format = vk::Format::eBc2UnormBlock;
+            } else if (pixel_four_cc == four_cc("DXT5")) {
+                file.format = vk::Format::eBc3UnormBlock;
+            } else if (pixel_four_cc == four_cc("ATI1") || pixel_four_cc == four_cc("BC4U")) {
+                file.format = vk::Format::eBc4UnormBlock;
+            } else if (pixel_four_cc == four_cc("ATI2") || pixel_four_cc == four_cc("BC5U")) {
+                file.format = vk::Format::eBc5UnormBlock;
+            } else {
+                throw std::runtime_error("Unsupported DDS four character code");
+            }
+        } else if ((pixel_flags & 0x40) && read_value<uint32_t>(data, size, 88) == 32) {
+            // Uncompressed 32 bit, told apart by the red mask
+            uint32_t red_mask = read_value<uint32_t>(data, size, 92);
+            if (red_mask == 0x000000FF) {
+                file.format = vk::Format::eR8G8B8A8Unorm;
+            } else if (red_mask == 0x00FF0000) {
+                file.format = vk::Format::eB8G8R8A8Unorm;
+            } else {
+                throw std::runtime_error("Unsupported DDS pixel layout");
+            }
+        } else {
+            throw std::runtime_error("Unsupported DDS pixel format");
+        }
+
+        // Levels are packed largest first without padding
+        size_t offset = data_offset;
+        for (uint32_t level = 0; level < level_count; level++) {
+            size_t level_size = (size_t)get_level_size(file.format, file.width, file.height, level);
+            file.levels.push_back(texture_level {offset, level_size});
+            offset += level_size;
+        }
+
+        file.data = data;
+        check_levels(file, size);
+        return file;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef TEXTURE_FORMATS_HPP
+#define TEXTURE_FORMATS_HPP
+
+#include "includes.hpp"
+#include <string>
+#include <vector>
+
+namespace vk_help {
+
+    // Texel block of a format, 1x1 for uncompressed formats
+    struct format_block {
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytes;
+    };
+
+    // Throws for formats textures are never created with
+    format_block get_format_block(const vk::Format &format);
+    bool is_block_compressed(const vk::Format &format);
+    vk::DeviceSize get_level_size(const vk::Format &format, uint32_t width, uint32_t height, uint32_t level);
+
+    struct texture_level {
+        size_t offset;      // Into texture_file::data
+        size_t size;
+    };
+
+    /**
+     * A texture read from a KTX2 or DDS container, with its mip levels ready for upload.
+     * Only single 2D images without supercompression are supported.
+     *
+     * data points into storage when the file was read by load_texture_file, otherwise
+     * into the caller's memory, such as a mapped asset pack, which has to outlive it.
+     */
+    struct texture_file {
+        vk::Format format;
+        uint32_t width;
+        uint32_t height;
+        std::vector<texture_level> levels;  // Largest first
+        const char *data;                   // The whole container
+        std::vector<char> storage;
+    };
+
+    // Containers the texture loaders understand, by extension
+    bool is_texture_container(const std::string &path);
+    texture_file load_texture_file(const std::string &path);
+    // Tells the container apart by its magic number
+    texture_file parse_texture_file(const char *data, const size_t size);
+    texture_file parse_ktx2(const char *data, const size_t size);
+    texture_file parse_dds(const char *data, const size_t size);
+}
+
+#endif // TEXTURE_FORMATS_HPP
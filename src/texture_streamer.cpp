@@ -0,0 +1,549 @@
+#include "texture_streamer.hpp"
+#include "image_ops.hpp"
+#include "pixel_convert.hpp"
+#include "texture_formats.hpp"
+#include "vulkan_helper.hpp"
+#include <iostream>
+#include <algorithm>
+
+namespace vk_mem {
+
+    // Bytes per pixel of the formats decoded images are uploaded in, 0 for any other
+    static uint32_t decoded_pixel_size(const vk::Format &format) {
+        switch (format) {
+            case vk::Format::eR8G8B8A8Unorm:
+            case vk::Format::eB10G11R11UfloatPack32:
+                return 4;
+            case vk::Format::eR16G16B16A16Sfloat:
+                return 8;
+            default:
+                return 0;
+        }
+    }
+
+    TextureStreamer::TextureStreamer(Manager *p_manager, TransferQueue *p_transfer, vk::PhysicalDevice *p_physical_device, vk::Device *p_device, const uint32_t worker_count, const vk::DeviceSize ring_size)
+        : p_manager(p_manager), p_transfer(p_transfer), p_device(p_device) {
+        shared = std::make_unique<Shared>();
+        shared->p_manager = p_manager;
+        shared->physical_device = *p_physical_device;
+        shared->blit_mips = vk_help::supports_linear_blit(*p_physical_device, vk::Format::eR8G8B8A8Unorm);
+        shared->ring = p_manager->create_transfer_buffer(ring_size);
+        shared->ring_data = static_cast<char*>(p_manager->mapMemory(shared->ring));
+        shared->ring_size = ring_size;
+
+        // Magenta and black checkers stand in for textures that are still loading
+        const uint32_t checkers[4] = {0xFFFF00FF, 0xFF000000, 0xFF000000, 0xFFFF00FF};
+        placeholder = create_texture_image(2, 2, 1, vk::Format::eR8G8B8A8Unorm, false);
+        p_transfer->upload(checkers, sizeof(checkers), p_manager->get_image(placeholder), 2, 2, vk::ImageLayout::eUndefined);
+        placeholder_view = create_view(placeholder, 1, vk::Format::eR8G8B8A8Unorm);
+
+        uint32_t count = worker_count != 0 ? worker_count : std::max(1u, std::thread::hardware_concurrency() / 2);
+        for (uint32_t i = 0; i < count; i++) {
+            workers.emplace_back(worker, shared.get());
+        }
+        std::cout << "Streaming textures with " << count << " decode threads" << std::endl;
+    }
+
+    void TextureStreamer::set_asset_pack(const asset_pack::Reader *p_pack) {
+        this->p_pack = p_pack;
+    }
+
+    void TextureStreamer::enable_cache(const std::string &directory) {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->cache = texture_cache::Cache(directory);
+    }
+
+    TextureHandle TextureStreamer::load(const std::string &path, const bool premultiply) {
+        Texture texture = {};
+        texture.state = TextureState::Decoding;
+        texture.path = path;
+        textures.push_back(texture);
+        ++pending;
+
+        uint32_t index = (uint32_t)textures.size() - 1;
+        {
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->requests.push_back(Request {index, path, p_pack ? p_pack->find(path) : nullptr, premultiply});
+        }
+        shared->requests_changed.notify_one();
+
+        return TextureHandle {index};
+    }
+
+    void TextureStreamer::worker(Shared *shared) {
+        while (true) {
+            Request request;
+            {
+                std::unique_lock<std::mutex> lock(shared->mutex);
+                shared->requests_changed.wait(lock, [shared]() { return shared->stopping || !shared->requests.empty(); });
+                if (shared->stopping) {
+                    return;
+                }
+                request = std::move(shared->requests.front());
+                shared->requests.pop_front();
+            }
+
+            Decoded decoded = {};
+            decoded.texture = request.texture;
+            decoded.format = vk::Format::eR8G8B8A8Unorm;
+
+            // Everything the upload needs, copied into staging back to back
+            std::vector<std::pair<const void*, size_t>> parts;
+            stbi_uc *pixels = nullptr;
+            std::vector<uint8_t> expanded;
+            std::vector<uint8_t> converted;
+            std::vector<uint8_t> mips;
+            vk_help::texture_file file;
+            texture_cache::Entry cached;
+
+            const asset_pack::Asset *asset = request.asset;
+            try {
+                bool container = asset ? asset->type == asset_pack::Type::Texture : vk_help::is_texture_container(request.path);
+                if (container) {
+                    // Pre-compressed levels go to the GPU as they are
+                    file = asset ? vk_help::parse_texture_file(asset->data, asset->size) : vk_help::load_texture_file(request.path);
+                    if (!vk_help::supports_sampled_format(shared->physical_device, file.format)) {
+                        throw std::runtime_error("Format " + vk::to_string(file.format) + " cannot be sampled on this device");
+                    }
+                    decoded.format = file.format;
+                    decoded.width = file.width;
+                    decoded.height = file.height;
+                    decoded.levels = (uint32_t)file.levels.size();
+                    for (auto &level : file.levels) {
+                        parts.push_back({file.data + level.offset, level.size});
+                    }
+                } else {
+                    // Loose sources are mapped as well, so they can be hashed and decoded without another copy
+                    mapped_file::File source_file;
+                    const char *source = asset ? asset->data : nullptr;
+                    size_t source_size = asset ? asset->size : 0;
+                    if (!asset) {
+                        source_file = mapped_file::File(request.path);
+                        source = source_file.data();
+                        source_size = source_file.size();
+                    }
+
+                    // Premultiplied pixels are a different entry for the same source
+                    uint64_t source_hash = 0;
+                    if (shared->cache.is_enabled()) {
+                        source_hash = texture_cache::hash(source, source_size, request.premultiply ? 1 : 0);
+                    }
+
+                    const uint8_t *base;
+                    uint32_t stored_levels = 1;
+                    bool hit = shared->cache.is_enabled() && shared->cache.find(request.path, source_hash, cached) && is_usable(*shared, cached);
+                    const stbi_uc *encoded = reinterpret_cast<const stbi_uc*>(source);
+                    if (hit) {
+                        decoded.width = cached.width;
+                        decoded.height = cached.height;
+                        decoded.format = vk::Format(cached.format);
+                        stored_levels = cached.levels;
+                        base = reinterpret_cast<const uint8_t*>(cached.pixels);
+                    } else if (stbi_is_hdr_from_memory(encoded, (int)source_size) || stbi_is_16_bit_from_memory(encoded, (int)source_size)) {
+                        stored_levels = decode_float(*shared, encoded, source_size, decoded, converted);
+                        base = converted.data();
+                    } else {
+                        // RGB sources are decoded as they are and expanded here, stb's own expansion is scalar
+                        int width, height, channels;
+                        if (!stbi_info_from_memory(encoded, (int)source_size, &width, &height, &channels)) {
+                            throw std::runtime_error(stbi_failure_reason());
+                        }
+                        int components = channels == 3 ? STBI_rgb : STBI_rgb_alpha;
+                        pixels = stbi_load_from_memory(encoded, (int)source_size, &width, &height, &channels, components);
+                        if (!pixels) {
+                            throw std::runtime_error(stbi_failure_reason());
+                        }
+                        decoded.width = width;
+                        decoded.height = height;
+
+                        size_t count = (size_t)width * height;
+                        if (components == STBI_rgb) {
+                            expanded.resize(count * 4);
+                            pixel_convert::expand_rgb_to_rgba(pixels, count, expanded.data());
+                            stbi_image_free(pixels);
+                            pixels = nullptr;
+                            base = expanded.data();
+                        } else {
+                            // Before the mips, so they are filtered premultiplied
+                            if (request.premultiply) {
+                                pixel_convert::premultiply_alpha(pixels, count, pixels);
+                            }
+                            base = pixels;
+                        }
+                    }
+
+                    decoded.levels = image_ops::mip_levels(decoded.width, decoded.height);
+                    uint32_t pixel_size = decoded_pixel_size(decoded.format);
+                    size_t base_size = (size_t)decoded.width * decoded.height * pixel_size;
+                    if (stored_levels == decoded.levels) {
+                        parts.push_back({base, image_ops::mip_chain_size(decoded.width, decoded.height, decoded.levels, 0, pixel_size)});
+                    } else {
+                        decoded.blit_mips = can_blit(*shared, decoded.format);
+                        parts.push_back({base, base_size});
+
+                        // The lower levels are built in cached memory, reading back from the write combined ring would be slow.
+                        // Only RGBA8 gets here, float formats that cannot be blitted come with their chain
+                        if (!decoded.blit_mips) {
+                            mips.resize(image_ops::mip_chain_size(decoded.width, decoded.height, decoded.levels, 1));
+                            image_ops::generate_mip_chain(base, decoded.width, decoded.height, decoded.levels, mips.data());
+                            parts.push_back({mips.data(), mips.size()});
+                        }
+                    }
+
+                    if (shared->cache.is_enabled() && !hit) {
+                        try {
+                            shared->cache.store(request.path, source_hash, decoded.width, decoded.height, decoded.blit_mips ? 1 : decoded.levels, (uint32_t)decoded.format, parts);
+                        } catch (const std::exception &e) {
+                            std::cerr << "Failed to cache texture " << request.path << ": " << e.what() << std::endl;
+                        }
+                    }
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Failed to load texture " << request.path << ": " << e.what() << std::endl;
+                stbi_image_free(pixels);
+                decoded.failed = true;
+                std::lock_guard<std::mutex> lock(shared->mutex);
+                shared->decoded.push_back(decoded);
+                continue;
+            }
+
+            vk::DeviceSize size = 0;
+            for (auto &part : parts) {
+                size += part.second;
+            }
+
+            char *destination;
+            if (size > shared->ring_size) {
+                // Too large to ever fit the ring, gets a staging buffer of its own
+                decoded.staging = shared->p_manager->create_transfer_buffer(size);
+                destination = static_cast<char*>(shared->p_manager->mapMemory(decoded.staging));
+            } else {
+                std::unique_lock<std::mutex> lock(shared->mutex);
+                shared->ring_changed.wait(lock, [&]() {
+                    return shared->stopping || ring_allocate(*shared, size, decoded.offset, decoded.region);
+                });
+                if (shared->stopping) {
+                    stbi_image_free(pixels);
+                    return;
+                }
+                destination = shared->ring_data + decoded.offset;
+            }
+
+            for (auto &part : parts) {
+                memcpy(destination, part.first, part.second);
+                destination += part.second;
+            }
+            stbi_image_free(pixels);
+
+            if (decoded.staging.generation != 0) {
+                shared->p_manager->unmapMemory(decoded.staging);
+            } else {
+                shared->p_manager->flush(shared->ring, decoded.offset, size);
+            }
+
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->decoded.push_back(decoded);
+        }
+    }
+
+    bool TextureStreamer::can_blit(const Shared &shared, const vk::Format &format) {
+        return format == vk::Format::eR8G8B8A8Unorm ? shared.blit_mips : vk_help::supports_linear_blit(shared.physical_device, format);
+    }
+
+    // Entries hold level 0 alone or the full chain. Only RGBA8 can build its mips from level 0 on the CPU
+    bool TextureStreamer::is_usable(const Shared &shared, const texture_cache::Entry &entry) {
+        vk::Format format = vk::Format(entry.format);
+        uint32_t pixel_size = decoded_pixel_size(format);
+        uint32_t levels = image_ops::mip_levels(entry.width, entry.height);
+        bool mips_missing = entry.levels != levels && format != vk::Format::eR8G8B8A8Unorm && !can_blit(shared, format);
+        if (pixel_size == 0 || (entry.levels != 1 && entry.levels != levels) || mips_missing) {
+            return false;
+        }
+        return entry.size >= image_ops::mip_chain_size(entry.width, entry.height, entry.levels, 0, pixel_size);
+    }
+
+    // Filtering happens in float, so the mips of formats without linear blits are built before the conversion
+    uint32_t TextureStreamer::decode_float(const Shared &shared, const stbi_uc *encoded, const size_t size, Decoded &decoded, std::vector<uint8_t> &converted) {
+        int width, height, channels;
+        bool hdr = stbi_is_hdr_from_memory(encoded, (int)size);
+        std::unique_ptr<float, void(*)(void*)> hdr_pixels(nullptr, stbi_image_free);
+        std::vector<float> unorm_pixels;
+        const float *pixels;
+        if (hdr) {
+            hdr_pixels.reset(stbi_loadf_from_memory(encoded, (int)size, &width, &height, &channels, STBI_rgb_alpha));
+            if (!hdr_pixels) {
+                throw std::runtime_error(stbi_failure_reason());
+            }
+            pixels = hdr_pixels.get();
+        } else {
+            stbi_us *loaded = stbi_load_16_from_memory(encoded, (int)size, &width, &height, &channels, STBI_rgb_alpha);
+            if (!loaded) {
+                throw std::runtime_error(stbi_failure_reason());
+            }
+            unorm_pixels.resize((size_t)width * height * 4);
+            pixel_convert::unorm16_to_float(loaded, unorm_pixels.size(), unorm_pixels.data());
+            stbi_image_free(loaded);
+            pixels = unorm_pixels.data();
+        }
+
+        // HDR files have no alpha and fit the packed format at half the size. 16 bit images keep
+        // their alpha in half floats, 6 bit mantissas would lose the precision they were saved for
+        decoded.width = width;
+        decoded.height = height;
+        decoded.format = hdr ? vk::Format::eB10G11R11UfloatPack32 : vk::Format::eR16G16B16A16Sfloat;
+        uint32_t levels = image_ops::mip_levels(width, height);
+        uint32_t stored_levels = can_blit(shared, decoded.format) ? 1 : levels;
+
+        std::vector<float> mips;
+        if (stored_levels > 1) {
+            mips.resize(image_ops::mip_chain_size(width, height, levels, 1, 16) / sizeof(float));
+            image_ops::generate_mip_chain_float(pixels, width, height, levels, mips.data());
+        }
+
+        uint32_t pixel_size = decoded_pixel_size(decoded.format);
+        size_t count = (size_t)width * height;
+        converted.resize(image_ops::mip_chain_size(width, height, stored_levels, 0, pixel_size));
+        auto convert = [&](const float *src, const size_t pixel_count, uint8_t *dst) {
+            if (hdr) {
+                pixel_convert::float_to_b10g11r11(src, pixel_count, reinterpret_cast<uint32_t*>(dst));
+            } else {
+                pixel_convert::float_to_half(src, pixel_count * 4, reinterpret_cast<uint16_t*>(dst));
+            }
+        };
+        convert(pixels, count, converted.data());
+        if (!mips.empty()) {
+            convert(mips.data(), mips.size() / 4, converted.data() + count * pixel_size);
+        }
+        return stored_levels;
+    }
+
+    // Regions are handed out in ring order and reclaimed from the oldest once their uploads completed
+    bool TextureStreamer::ring_allocate(Shared &shared, const vk::DeviceSize size, vk::DeviceSize &offset, uint64_t &region) {
+        vk::DeviceSize aligned = ((size + STAGING_RING_ALIGNMENT - 1) / STAGING_RING_ALIGNMENT) * STAGING_RING_ALIGNMENT;
+
+        vk::DeviceSize start = 0;
+        if (!shared.regions.empty()) {
+            vk::DeviceSize oldest = shared.regions.front().offset;
+            vk::DeviceSize head = shared.regions.back().end;
+            if (head > oldest) {
+                if (head + aligned <= shared.ring_size) {
+                    start = head;
+                } else if (aligned <= oldest) {
+                    start = 0;
+                } else {
+                    return false;
+                }
+            } else if (head + aligned <= oldest) {
+                start = head;
+            } else {
+                return false;
+            }
+        }
+
+        offset = start;
+        region = shared.first_region + shared.regions.size();
+        shared.regions.push_back(RingRegion {start, start + aligned, false});
+        return true;
+    }
+
+    void TextureStreamer::ring_release(const uint64_t region) {
+        {
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->regions[region - shared->first_region].done = true;
+            while (!shared->regions.empty() && shared->regions.front().done) {
+                shared->regions.pop_front();
+                ++shared->first_region;
+            }
+        }
+        shared->ring_changed.notify_all();
+    }
+
+    ImageHandle TextureStreamer::create_texture_image(const uint32_t width, const uint32_t height, const uint32_t levels, const vk::Format &format, const bool blit_mips) {
+        vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+        if (levels > 1 && blit_mips) {
+            usage |= vk::ImageUsageFlagBits::eTransferSrc;
+        }
+
+        vk::ImageCreateInfo create_info(
+            vk::ImageCreateFlags(),
+            vk::ImageType::e2D,                         // Type
+            format,                                     // Format
+            vk::Extent3D(width, height, 1),             // Extent
+            levels,                                     // Mip levels
+            1,                                          // Array layers
+            vk::SampleCountFlagBits::e1,                // Samples
+            vk::ImageTiling::eOptimal,                  // Tiling
+            usage,                                      // Usage
+            vk::SharingMode::eExclusive,                // Sharing mode
+            0,                                          // Queue family count
+            nullptr,                                    // Queue families
+            vk::ImageLayout::eUndefined                 // Layout
+        );
+
+        return p_manager->create_image(create_info);
+    }
+
+    vk::ImageView TextureStreamer::create_view(const ImageHandle &handle, const uint32_t levels, const vk::Format &format) {
+        vk::ImageViewCreateInfo create_info(
+            vk::ImageViewCreateFlags(),
+            p_manager->get_image(handle),
+            vk::ImageViewType::e2D,
+            format,
+            vk::ComponentMapping(),
+            vk::ImageSubresourceRange(
+                vk::ImageAspectFlagBits::eColor,
+                0,      // Base mip level
+                levels, // Level count
+                0,      // Base array layer
+                1       // Layer count
+            )
+        );
+
+        return p_device->createImageView(create_info);
+    }
+
+    uint32_t TextureStreamer::update() {
+        if (!shared) {
+            return 0;
+        }
+
+        std::vector<Decoded> decoded;
+        {
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            decoded.swap(shared->decoded);
+        }
+
+        // Everything decoded since the last frame goes out as one batch
+        std::vector<uint32_t> recorded;
+        for (auto &item : decoded) {
+            Texture &texture = textures[item.texture];
+            if (item.failed) {
+                texture.state = TextureState::Failed;
+                --pending;
+                continue;
+            }
+
+            // Out of device memory or an extent above the device limits only fails this texture,
+            // nothing was recorded for it yet so its staging memory is given back right away
+            try {
+                texture.image = create_texture_image(item.width, item.height, item.levels, item.format, item.blit_mips);
+            } catch (const std::exception &e) {
+                std::cerr << "Failed to create texture " << texture.path << ": " << e.what() << std::endl;
+                if (item.staging.generation != 0) {
+                    p_manager->free_immediate(item.staging);
+                } else {
+                    ring_release(item.region);
+                }
+                texture.state = TextureState::Failed;
+                --pending;
+                continue;
+            }
+            texture.levels = item.levels;
+            texture.format = item.format;
+            vk::Image image = p_manager->get_image(texture.image);
+
+            texture.uses_ring = item.staging.generation == 0;
+            const BufferHandle &source = texture.uses_ring ? shared->ring : item.staging;
+            vk::DeviceSize offset = texture.uses_ring ? item.offset : 0;
+            if (item.blit_mips) {
+                p_transfer->copy_buffer_generate_mips(source, image, item.width, item.height, item.levels, vk::ImageLayout::eUndefined, offset);
+            } else {
+                p_transfer->copy_buffer(source, image, item.width, item.height, vk::ImageLayout::eUndefined, offset, item.levels, item.format);
+            }
+
+            if (texture.uses_ring) {
+                texture.region = item.region;
+            } else {
+                p_transfer->free_after_upload(item.staging);
+            }
+            texture.state = TextureState::Uploading;
+            recorded.push_back(item.texture);
+        }
+
+        if (!recorded.empty()) {
+            UploadTicket ticket = p_transfer->submit();
+            for (uint32_t index : recorded) {
+                textures[index].ticket = ticket;
+            }
+            uploading.insert(uploading.end(), recorded.begin(), recorded.end());
+        }
+
+        uint32_t published = 0;
+        p_transfer->collect();
+        for (auto it = uploading.begin(); it != uploading.end();) {
+            Texture &texture = textures[*it];
+            if (!p_transfer->is_complete(texture.ticket)) {
+                ++it;
+                continue;
+            }
+
+            texture.view = create_view(texture.image, texture.levels, texture.format);
+            texture.state = TextureState::Ready;
+            if (texture.uses_ring) {
+                ring_release(texture.region);
+            }
+            --pending;
+            ++published;
+            it = uploading.erase(it);
+        }
+
+        return published;
+    }
+
+    TextureState TextureStreamer::get_state(const TextureHandle &handle) const {
+        return textures.at(handle.index).state;
+    }
+
+    vk::ImageView TextureStreamer::get_view(const TextureHandle &handle) const {
+        const Texture &texture = textures.at(handle.index);
+        return texture.state == TextureState::Ready ? texture.view : placeholder_view;
+    }
+
+    size_t TextureStreamer::get_pending_count() const {
+        return pending;
+    }
+
+    void TextureStreamer::destroy() {
+        if (!shared) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->stopping = true;
+        }
+        shared->requests_changed.notify_all();
+        shared->ring_changed.notify_all();
+        for (auto &thread : workers) {
+            thread.join();
+        }
+        workers.clear();
+
+        for (uint32_t index : uploading) {
+            p_transfer->wait(textures[index].ticket);
+        }
+        uploading.clear();
+
+        for (auto &item : shared->decoded) {
+            if (item.staging.generation != 0) {
+                p_manager->free_immediate(item.staging);
+            }
+        }
+
+        for (auto &texture : textures) {
+            if (texture.view) {
+                p_device->destroyImageView(texture.view);
+            }
+            if (texture.image.generation != 0) {
+                p_manager->free_image(texture.image);
+            }
+        }
+        textures.clear();
+
+        p_device->destroyImageView(placeholder_view);
+        p_manager->free_image(placeholder);
+        p_manager->free_immediate(shared->ring);
+        shared.reset();
+    }
+
+}
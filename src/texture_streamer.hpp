@@ -0,0 +1,168 @@
+#ifndef TEXTURE_STREAMER_HPP
+#define TEXTURE_STREAMER_HPP
+
+#include "vulkan_memory.hpp"
+#include "vulkan_transfer.hpp"
+#include "util/asset_pack.hpp"
+#include "util/texture_cache.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace vk_mem {
+
+    // Staging memory shared by all decoded textures waiting for their upload
+    static const vk::DeviceSize STAGING_RING_SIZE = 32 * 1024 * 1024;
+    // Offsets in the ring are multiples of this, which satisfies any texel size
+    static const vk::DeviceSize STAGING_RING_ALIGNMENT = 16;
+
+    struct TextureHandle {
+        uint32_t index = 0;
+    };
+
+    enum class TextureState {
+        Decoding,
+        Uploading,
+        Ready,
+        Failed
+    };
+
+    /**
+     * Loads textures in the background. A pool of workers decodes images with stb_image and
+     * writes the pixels into a persistently mapped staging ring. Once per frame update()
+     * records the copies of everything decoded since into the TransferQueue, submits them
+     * as one batch and publishes textures whose batch has completed. Until then get_view
+     * returns a placeholder.
+     *
+     * Decoded images get a full mip chain. When RGBA8 supports linear blits the GPU blits it
+     * from level 0, otherwise the workers box filter it on the CPU and the whole chain goes
+     * through the ring. KTX2 and DDS files are uploaded as stored, in their own format and
+     * with their own levels.
+     *
+     * Paths found in the asset pack are read from its mapping, container levels are copied
+     * from there into the ring without an intermediate buffer.
+     *
+     * RGB images are expanded to RGBA with the SIMD kernels of pixel_convert, which also
+     * premultiply alpha when asked to. HDR images are uploaded as B10G11R11_UFLOAT and 16 bit
+     * images as R16G16B16A16_SFLOAT, converted by the same kernels.
+     *
+     * With the cache enabled, decoded pixels are kept on disk keyed by the hash of their
+     * source, later loads of an unchanged source map them instead of decoding.
+     *
+     * load, update, get_view and destroy belong to the render thread.
+     */
+    class TextureStreamer {
+        public:
+        TextureStreamer() {};
+        // worker_count 0 uses half the hardware threads
+        TextureStreamer(Manager *p_manager, TransferQueue *p_transfer, vk::PhysicalDevice *p_physical_device, vk::Device *p_device, const uint32_t worker_count = 0, const vk::DeviceSize ring_size = STAGING_RING_SIZE);
+
+        // Looked up by load, the pack has to outlive the streamer
+        void set_asset_pack(const asset_pack::Reader *p_pack);
+        // Call before the first load
+        void enable_cache(const std::string &directory);
+
+        // premultiply multiplies the colour of 8 bit images by their alpha, other sources are left as stored
+        TextureHandle load(const std::string &path, const bool premultiply = false);
+
+        // Returns the number of textures published by this call
+        uint32_t update();
+
+        TextureState get_state(const TextureHandle &handle) const;
+        // The placeholder until the texture is ready, or if it failed to load
+        vk::ImageView get_view(const TextureHandle &handle) const;
+        size_t get_pending_count() const;
+
+        void destroy();
+
+        private:
+        struct RingRegion {
+            vk::DeviceSize offset;
+            vk::DeviceSize end;
+            bool done;
+        };
+
+        struct Request {
+            uint32_t texture;
+            std::string path;
+            const asset_pack::Asset *asset;     // Null for loose files
+            bool premultiply;
+        };
+
+        struct Decoded {
+            uint32_t texture;
+            uint32_t width;
+            uint32_t height;
+            uint32_t levels;
+            vk::Format format;
+            bool blit_mips;         // Only level 0 was staged
+            uint64_t region;        // Ring region id, unused with own staging
+            vk::DeviceSize offset;
+            BufferHandle staging;   // Set when the image did not fit the ring
+            bool failed;
+        };
+
+        struct Texture {
+            TextureState state;
+            std::string path;
+            ImageHandle image;
+            uint32_t levels;
+            vk::Format format;
+            vk::ImageView view;
+            UploadTicket ticket;
+            uint64_t region;
+            bool uses_ring;
+        };
+
+        // State shared with the workers, behind a pointer so the streamer stays movable
+        struct Shared {
+            std::mutex mutex;
+            std::condition_variable requests_changed;
+            std::condition_variable ring_changed;
+            bool stopping = false;
+
+            std::deque<Request> requests;
+            std::vector<Decoded> decoded;
+
+            Manager *p_manager;
+            vk::PhysicalDevice physical_device;
+            bool blit_mips;
+            texture_cache::Cache cache;
+            BufferHandle ring;
+            char *ring_data;
+            vk::DeviceSize ring_size;
+            std::deque<RingRegion> regions;
+            uint64_t first_region = 0;      // Id of regions.front()
+        };
+
+        Manager *p_manager;
+        TransferQueue *p_transfer;
+        vk::Device *p_device;
+        const asset_pack::Reader *p_pack = nullptr;
+
+        std::unique_ptr<Shared> shared;
+        std::vector<std::thread> workers;
+        std::vector<Texture> textures;
+        std::vector<uint32_t> uploading;
+        size_t pending = 0;
+
+        ImageHandle placeholder;
+        vk::ImageView placeholder_view;
+
+        static void worker(Shared *shared);
+        static bool can_blit(const Shared &shared, const vk::Format &format);
+        static bool is_usable(const Shared &shared, const texture_cache::Entry &entry);
+        // Decodes an HDR or 16 bit image into converted, returns how many levels it holds
+        static uint32_t decode_float(const Shared &shared, const stbi_uc *encoded, const size_t size, Decoded &decoded, std::vector<uint8_t> &converted);
+        static bool ring_allocate(Shared &shared, const vk::DeviceSize size, vk::DeviceSize &offset, uint64_t &region);
+        void ring_release(const uint64_t region);
+        vk::ImageView create_view(const ImageHandle &handle, const uint32_t levels, const vk::Format &format);
+        ImageHandle create_texture_image(const uint32_t width, const uint32_t height, const uint32_t levels, const vk::Format &format, const bool blit_mips);
+    };
+
+}
+
+#endif
@@ -0,0 +1,155 @@
+/*
+Binary allocation trace.
+
+A trace starts with a header describing the memory types and heaps of the device,
+followed by fixed size events. Events are written in host byte order and describe
+placement as the device sees it: every buffer and image bound to device memory,
+slab slot allocations, frees at the time the memory is actually released, buffers
+moved by defragmentation and frame boundaries.
+*/
+
+#ifndef ALLOC_TRACE_HPP
+#define ALLOC_TRACE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+namespace alloc_trace {
+
+    static const char MAGIC[4] = {'V', 'K', 'M', 'T'};
+    static const uint32_t VERSION = 2;
+
+    enum class Op : uint8_t {
+        CreateBuffer = 0,
+        CreateImage = 1,
+        CreateSlot = 2,     // Small buffer placed in a slab, takes no device memory of its own
+        Free = 3,
+        Map = 4,
+        Unmap = 5,
+        Frame = 6,          // size holds the number of completed frames
+        Move = 7            // Buffer moved by defragmentation, it keeps its record and size holds the bytes copied
+    };
+
+    // Placed in a dedicated block, for whatever reason the Manager had
+    static const uint8_t FLAG_DEDICATED = 1;
+    static const uint8_t FLAG_OPTIMAL_IMAGE = 2;
+    // Free of the old placement of a moved buffer, the buffer itself lives on
+    static const uint8_t FLAG_MOVED = 4;
+
+    // What VkMemoryDedicatedRequirements asked for, independent of the Manager's own size threshold
+    enum class Dedicated : uint8_t {
+        None = 0,
+        Preferred = 1,
+        Required = 2
+    };
+
+    struct MemoryType {
+        uint32_t property_flags;
+        uint32_t heap;
+    };
+
+    struct Header {
+        std::vector<MemoryType> memory_types;
+        std::vector<uint64_t> heap_sizes;
+    };
+
+    struct Event {
+        uint8_t op;
+        uint8_t flags;
+        uint8_t memory_type;
+        uint8_t dedicated;      // Dedicated requirement of the driver for buffers and images
+        uint32_t index;         // Allocation record, together with generation unique for the trace
+        uint32_t generation;
+        uint32_t usage;         // Buffer or image usage flags
+        uint32_t property_flags;
+        uint32_t pool;          // Block pool the allocation was placed in, size class for slots
+        uint64_t size;
+        uint64_t alignment;
+        uint64_t frame;
+    };
+
+    static_assert(sizeof(Event) == 48, "Trace events must stay packed");
+
+    class Writer {
+        public:
+        Writer(const std::string &filename, const Header &header);
+
+        void write(const Event &event);
+        uint64_t get_event_count() const { return event_count; }
+
+        private:
+        std::mutex mutex;
+        std::ofstream file;
+        uint64_t event_count = 0;
+    };
+
+    class Reader {
+        public:
+        explicit Reader(const std::string &filename);
+
+        const Header& get_header() const { return header; }
+        bool next(Event &event);
+
+        private:
+        std::ifstream file;
+        Header header;
+    };
+
+    inline Writer::Writer(const std::string &filename, const Header &header)
+        : file(filename, std::ios::binary) {
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open file " + filename);
+        }
+
+        uint32_t type_count = (uint32_t)header.memory_types.size();
+        uint32_t heap_count = (uint32_t)header.heap_sizes.size();
+        file.write(MAGIC, sizeof(MAGIC));
+        file.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+        file.write(reinterpret_cast<const char*>(&type_count), sizeof(type_count));
+        file.write(reinterpret_cast<const char*>(&heap_count), sizeof(heap_count));
+        file.write(reinterpret_cast<const char*>(header.memory_types.data()), type_count * sizeof(MemoryType));
+        file.write(reinterpret_cast<const char*>(header.heap_sizes.data()), heap_count * sizeof(uint64_t));
+    }
+
+    inline void Writer::write(const Event &event) {
+        std::lock_guard<std::mutex> lock(mutex);
+        file.write(reinterpret_cast<const char*>(&event), sizeof(Event));
+        ++event_count;
+    }
+
+    inline Reader::Reader(const std::string &filename)
+        : file(filename, std::ios::binary) {
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open file " + filename);
+        }
+
+        char magic[4];
+        uint32_t version, type_count, heap_count;
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char*>(&version), sizeof(version));
+        if (!file || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || version != VERSION) {
+            throw std::runtime_error("Not an allocation trace: " + filename);
+        }
+
+        file.read(reinterpret_cast<char*>(&type_count), sizeof(type_count));
+        file.read(reinterpret_cast<char*>(&heap_count), sizeof(heap_count));
+        header.memory_types.resize(type_count);
+        header.heap_sizes.resize(heap_count);
+        file.read(reinterpret_cast<char*>(header.memory_types.data()), type_count * sizeof(MemoryType));
+        file.read(reinterpret_cast<char*>(header.heap_sizes.data()), heap_count * sizeof(uint64_t));
+        if (!file) {
+            throw std::runtime_error("Truncated trace header: " + filename);
+        }
+    }
+
+    inline bool Reader::next(Event &event) {
+        return (bool)file.read(reinterpret_cast<char*>(&event), sizeof(Event));
+    }
+}
+
+#endif // ALLOC_TRACE_HPP
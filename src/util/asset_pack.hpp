@@ -0,0 +1,202 @@
+/*
+Packed asset archive.
+
+A pack starts with a header, followed by the payloads and an index at the end. Every
+payload starts at a multiple of PAYLOAD_ALIGNMENT from the start of the file, so a
+mapped pack can hand out pointers that are aligned for SPIR-V words and wide copies
+into staging memory. The index holds fixed size entries followed by their names.
+Everything is stored in host byte order.
+
+Packs are read through a memory mapping and assets point straight into it.
+*/
+
+#ifndef ASSET_PACK_HPP
+#define ASSET_PACK_HPP
+
+#include "mapped_file.hpp"
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+#include <stdexcept>
+
+namespace asset_pack {
+
+    static const char MAGIC[4] = {'V', 'K', 'A', 'P'};
+    static const uint32_t VERSION = 1;
+    static const uint64_t PAYLOAD_ALIGNMENT = 64;
+
+    enum class Type : uint32_t {
+        Raw = 0,
+        Shader = 1,     // SPIR-V
+        Image = 2,      // Encoded image decoded with stb_image
+        Texture = 3     // KTX2 or DDS container
+    };
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t entry_count;
+        uint32_t names_size;
+        uint64_t index_offset;
+    };
+
+    struct Entry {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t type;
+        uint32_t name_offset;   // Into the names following the entries
+        uint32_t name_length;
+        uint32_t reserved;
+    };
+
+    struct Asset {
+        const char *data;
+        size_t size;
+        Type type;
+    };
+
+    // Guesses the type of a loose file from its extension
+    inline Type type_from_path(const std::string &path) {
+        std::string extension = path.substr(path.find_last_of('.') + 1);
+        for (auto &c : extension) {
+            c = (char)tolower(c);
+        }
+
+        if (extension == "spv") {
+            return Type::Shader;
+        } else if (extension == "ktx2" || extension == "dds") {
+            return Type::Texture;
+        } else if (extension == "jpg" || extension == "jpeg" || extension == "png" || extension == "tga" || extension == "bmp" || extension == "hdr") {
+            return Type::Image;
+        }
+        return Type::Raw;
+    }
+
+    class Writer {
+        public:
+        explicit Writer(const std::string &filename);
+
+        void add(const std::string &name, const Type type, const void *data, const size_t size);
+        // Writes the index and the final header, nothing can be added afterwards
+        void finish();
+
+        private:
+        std::ofstream file;
+        std::vector<Entry> entries;
+        std::string names;
+        uint64_t position = 0;
+
+        void pad(const uint64_t alignment);
+    };
+
+    class Reader {
+        public:
+        Reader() {};
+        explicit Reader(const std::string &filename);
+
+        bool is_open() const { return file.is_open(); }
+        // Null when the pack does not contain name
+        const Asset* find(const std::string &name) const;
+        const std::unordered_map<std::string, Asset>& get_assets() const { return assets; }
+
+        private:
+        mapped_file::File file;
+        std::unordered_map<std::string, Asset> assets;
+    };
+
+    inline Writer::Writer(const std::string &filename)
+        : file(filename, std::ios::binary) {
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open file " + filename);
+        }
+
+        // Rewritten by finish once the index offset is known
+        Header header = {};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        position = sizeof(header);
+    }
+
+    inline void Writer::pad(const uint64_t alignment) {
+        static const char zeros[PAYLOAD_ALIGNMENT] = {};
+        uint64_t padding = (alignment - position % alignment) % alignment;
+        file.write(zeros, padding);
+        position += padding;
+    }
+
+    inline void Writer::add(const std::string &name, const Type type, const void *data, const size_t size) {
+        pad(PAYLOAD_ALIGNMENT);
+
+        Entry entry = {};
+        entry.offset = position;
+        entry.size = size;
+        entry.type = (uint32_t)type;
+        entry.name_offset = (uint32_t)names.size();
+        entry.name_length = (uint32_t)name.size();
+        entries.push_back(entry);
+        names += name;
+
+        file.write(static_cast<const char*>(data), size);
+        position += size;
+    }
+
+    inline void Writer::finish() {
+        pad(alignof(Entry));
+
+        Header header = {};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.entry_count = (uint32_t)entries.size();
+        header.names_size = (uint32_t)names.size();
+        header.index_offset = position;
+
+        file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+        file.write(names.data(), names.size());
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.close();
+
+        if (!file) {
+            throw std::runtime_error("Failed to write asset pack");
+        }
+    }
+
+    inline Reader::Reader(const std::string &filename)
+        : file(filename) {
+        Header header;
+        if (file.size() < sizeof(header)) {
+            throw std::runtime_error("Not an asset pack: " + filename);
+        }
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+            throw std::runtime_error("Not an asset pack: " + filename);
+        }
+
+        uint64_t names_offset = header.index_offset + (uint64_t)header.entry_count * sizeof(Entry);
+        if (header.index_offset % alignof(Entry) != 0 || names_offset + header.names_size > file.size()) {
+            throw std::runtime_error("Truncated asset pack index: " + filename);
+        }
+
+        const Entry *entries = reinterpret_cast<const Entry*>(file.data() + header.index_offset);
+        const char *names = file.data() + names_offset;
+        for (uint32_t i = 0; i < header.entry_count; i++) {
+            const Entry &entry = entries[i];
+            if (entry.offset + entry.size > header.index_offset || (uint64_t)entry.name_offset + entry.name_length > header.names_size) {
+                throw std::runtime_error("Corrupt asset pack entry in " + filename);
+            }
+
+            std::string name(names + entry.name_offset, entry.name_length);
+            assets[name] = Asset {file.data() + entry.offset, (size_t)entry.size, (Type)entry.type};
+        }
+    }
+
+    inline const Asset* Reader::find(const std::string &name) const {
+        auto it = assets.find(name);
+        return it != assets.end() ? &it->second : nullptr;
+    }
+}
+
+#endif // ASSET_PACK_HPP
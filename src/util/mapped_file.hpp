@@ -0,0 +1,128 @@
+/*
+Read only memory mapped files.
+
+The whole file is mapped once and stays mapped for the lifetime of the object, pages are
+brought in by the OS on first access. Empty files are valid and have no mapping.
+*/
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace mapped_file {
+
+    class File {
+        public:
+        File() {};
+        explicit File(const std::string &filename);
+        ~File();
+
+        File(File &&other) { *this = std::move(other); }
+        File& operator=(File &&other);
+
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+
+        const char* data() const { return mapping; }
+        size_t size() const { return length; }
+        bool is_open() const { return open; }
+
+        private:
+        const char *mapping = nullptr;
+        size_t length = 0;
+        bool open = false;
+
+        void close();
+    };
+
+    inline File::File(const std::string &filename) {
+        #ifdef _WIN32
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Failed to open file " + filename);
+        }
+
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(file, &file_size);
+        length = (size_t)file_size.QuadPart;
+
+        if (length > 0) {
+            HANDLE file_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (file_mapping) {
+                mapping = static_cast<const char*>(MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0));
+                // The view keeps the mapping alive
+                CloseHandle(file_mapping);
+            }
+        }
+        CloseHandle(file);
+        #else
+        int file = ::open(filename.c_str(), O_RDONLY);
+        if (file < 0) {
+            throw std::runtime_error("Failed to open file " + filename);
+        }
+
+        struct stat file_stat;
+        fstat(file, &file_stat);
+        length = (size_t)file_stat.st_size;
+
+        if (length > 0) {
+            void *view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+            if (view != MAP_FAILED) {
+                mapping = static_cast<const char*>(view);
+            }
+        }
+        ::close(file);
+        #endif
+
+        if (length > 0 && !mapping) {
+            throw std::runtime_error("Failed to map file " + filename);
+        }
+        open = true;
+    }
+
+    inline File::~File() {
+        close();
+    }
+
+    inline File& File::operator=(File &&other) {
+        if (this != &other) {
+            close();
+            mapping = std::exchange(other.mapping, nullptr);
+            length = std::exchange(other.length, 0);
+            open = std::exchange(other.open, false);
+        }
+        return *this;
+    }
+
+    inline void File::close() {
+        if (mapping) {
+            #ifdef _WIN32
+            UnmapViewOfFile(mapping);
+            #else
+            munmap(const_cast<char*>(mapping), length);
+            #endif
+        }
+        mapping = nullptr;
+        length = 0;
+        open = false;
+    }
+}
+
+#endif // MAPPED_FILE_HPP
@@ -0,0 +1,201 @@
+/*
+Disk cache of decoded texture pixels.
+
+Each source path has one entry file, named after the hash of the path, that holds the
+decoded pixels of level 0 and any lower levels generated with them, in the format they
+are uploaded in. The entry
+records the XXH64 hash of the source file contents and is only used while the source
+still hashes the same, a changed source overwrites it on the next decode.
+
+Entries are written to a temporary file and renamed into place, so readers on other
+threads or processes never see a partial entry. Hits are memory mapped.
+*/
+
+#ifndef TEXTURE_CACHE_HPP
+#define TEXTURE_CACHE_HPP
+
+#include "mapped_file.hpp"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <filesystem>
+#include <stdexcept>
+
+namespace texture_cache {
+
+    static const char MAGIC[4] = {'V', 'K', 'T', 'C'};
+    // Bump when the stored pixels would change for the same source, e.g. a new mip filter
+    static const uint32_t VERSION = 2;
+    static const uint64_t DATA_OFFSET = 64;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t source_hash;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levels;
+        uint32_t format;        // VkFormat
+        uint64_t data_size;
+    };
+
+    // A mapped hit, pixels stay valid as long as the entry lives
+    struct Entry {
+        uint32_t width;
+        uint32_t height;
+        uint32_t levels;
+        uint32_t format;
+        const char *pixels;
+        size_t size;
+        mapped_file::File file;
+    };
+
+    // XXH64
+    inline uint64_t hash(const void *data, const size_t size, const uint64_t seed = 0) {
+        const uint64_t P1 = 11400714785074694791ULL, P2 = 14029467366897019727ULL, P3 = 1609587929392839161ULL;
+        const uint64_t P4 = 9650029242287828579ULL, P5 = 2870177450012600261ULL;
+        auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+        auto read64 = [](const uint8_t *p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; };
+        auto read32 = [](const uint8_t *p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; };
+        auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; };
+        auto merge = [&](uint64_t acc, uint64_t value) { return (acc ^ round(0, value)) * P1 + P4; };
+
+        const uint8_t *p = static_cast<const uint8_t*>(data);
+        const uint8_t *end = p + size;
+        uint64_t h;
+
+        if (size >= 32) {
+            uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+            for (; p + 32 <= end; p += 32) {
+                v1 = round(v1, read64(p));
+                v2 = round(v2, read64(p + 8));
+                v3 = round(v3, read64(p + 16));
+                v4 = round(v4, read64(p + 24));
+            }
+            h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+            h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+        } else {
+            h = seed + P5;
+        }
+
+        h += size;
+        for (; p + 8 <= end; p += 8) {
+            h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+        }
+        if (p + 4 <= end) {
+            h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+            p += 4;
+        }
+        for (; p < end; p++) {
+            h = rotl(h ^ (*p * P5), 11) * P1;
+        }
+
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    class Cache {
+        public:
+        Cache() {};
+        // Creates the directory if needed
+        explicit Cache(const std::string &directory);
+
+        bool is_enabled() const { return !directory.empty(); }
+
+        // Maps the entry of name if it was stored for a source with source_hash
+        bool find(const std::string &name, const uint64_t source_hash, Entry &entry) const;
+        // parts are written back to back as the pixel data
+        void store(const std::string &name, const uint64_t source_hash, const uint32_t width, const uint32_t height, const uint32_t levels, const uint32_t format, const std::vector<std::pair<const void*, size_t>> &parts) const;
+
+        private:
+        std::string directory;
+
+        std::string entry_filename(const std::string &name) const;
+    };
+
+    inline Cache::Cache(const std::string &directory)
+        : directory(directory) {
+        std::filesystem::create_directories(directory);
+    }
+
+    inline std::string Cache::entry_filename(const std::string &name) const {
+        std::ostringstream filename;
+        filename << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash(name.data(), name.size()) << ".tex";
+        return filename.str();
+    }
+
+    inline bool Cache::find(const std::string &name, const uint64_t source_hash, Entry &entry) const {
+        std::string filename = entry_filename(name);
+        std::error_code error;
+        if (!std::filesystem::exists(filename, error)) {
+            return false;
+        }
+
+        mapped_file::File file(filename);
+        Header header;
+        if (file.size() < DATA_OFFSET) {
+            return false;
+        }
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.source_hash != source_hash
+            || DATA_OFFSET + header.data_size > file.size()) {
+            return false;
+        }
+
+        entry.width = header.width;
+        entry.height = header.height;
+        entry.levels = header.levels;
+        entry.format = header.format;
+        entry.pixels = file.data() + DATA_OFFSET;
+        entry.size = (size_t)header.data_size;
+        entry.file = std::move(file);
+        return true;
+    }
+
+    inline void Cache::store(const std::string &name, const uint64_t source_hash, const uint32_t width, const uint32_t height, const uint32_t levels, const uint32_t format, const std::vector<std::pair<const void*, size_t>> &parts) const {
+        std::string filename = entry_filename(name);
+        std::ostringstream temporary;
+        temporary << filename << "." << std::this_thread::get_id() << ".tmp";
+
+        Header header = {};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.source_hash = source_hash;
+        header.width = width;
+        header.height = height;
+        header.levels = levels;
+        header.format = format;
+        for (auto &part : parts) {
+            header.data_size += part.second;
+        }
+
+        {
+            std::ofstream file(temporary.str(), std::ios::binary);
+            if (!file.is_open()) {
+                throw std::runtime_error("Failed to open file " + temporary.str());
+            }
+            char padding[DATA_OFFSET] = {};
+            memcpy(padding, &header, sizeof(header));
+            file.write(padding, sizeof(padding));
+            for (auto &part : parts) {
+                file.write(static_cast<const char*>(part.first), part.second);
+            }
+            if (!file) {
+                throw std::runtime_error("Failed to write file " + temporary.str());
+            }
+        }
+
+        std::filesystem::rename(temporary.str(), filename);
+    }
+}
+
+#endif // TEXTURE_CACHE_HPP
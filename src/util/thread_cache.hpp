@@ -0,0 +1,162 @@
+/*
+Per-thread caches in front of a shared free list.
+
+Each thread keeps a small local list of items. Items are moved between the local
+lists and the shared list, which is guarded by a mutex, in batches of batch_size,
+so the lock is taken at most once per batch of acquires or releases. The shared
+list is filled on demand by a refill callback that runs with the lock held, only
+once it has run dry.
+
+Local lists live in thread local storage keyed by a unique cache id. A thread that
+exits hands its items back to the shared list, entries of destroyed caches are
+pruned from the other threads' storage the next time they use any cache.
+*/
+
+#ifndef THREAD_CACHE_HPP
+#define THREAD_CACHE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+namespace thread_cache {
+
+    template<typename T>
+    class Cache {
+        public:
+        explicit Cache(size_t batch_size) : id(next_id()), batch_size(batch_size), state(std::make_shared<Shared>()) {};
+        ~Cache();
+
+        Cache(const Cache&) = delete;
+        Cache& operator=(const Cache&) = delete;
+
+        /**
+         * Takes an item from the calling thread's cache. When it is empty a batch is moved
+         * over from the shared list, which is topped up by refill(std::vector<T> &shared)
+         * first if it is empty. Returns false if refill could not provide any items.
+         */
+        template<typename Refill>
+        bool acquire(T &item, Refill refill);
+
+        // Returns an item to the calling thread's cache, spilling a batch to the shared list when full
+        void release(const T &item);
+
+        private:
+        struct Shared {
+            std::mutex mutex;
+            std::vector<T> items;
+        };
+
+        struct Local {
+            std::weak_ptr<Shared> owner;
+            std::vector<T> items;
+        };
+
+        // The calling thread's local lists, flushed back to their caches when the thread exits
+        struct LocalLists {
+            std::unordered_map<uint64_t, Local> lists;
+            uint64_t seen_epoch = 0;
+
+            ~LocalLists() {
+                for (auto &entry : lists) {
+                    std::shared_ptr<Shared> owner = entry.second.owner.lock();
+                    if (owner && !entry.second.items.empty()) {
+                        std::lock_guard<std::mutex> lock(owner->mutex);
+                        owner->items.insert(owner->items.end(), entry.second.items.begin(), entry.second.items.end());
+                    }
+                }
+            }
+        };
+
+        uint64_t id;
+        size_t batch_size;
+        std::shared_ptr<Shared> state;
+
+        static uint64_t next_id() {
+            static std::atomic<uint64_t> counter(0);
+            return ++counter;
+        }
+
+        // Bumped whenever a cache is destroyed
+        static std::atomic<uint64_t>& epoch() {
+            static std::atomic<uint64_t> destroyed(0);
+            return destroyed;
+        }
+
+        static LocalLists& local_lists() {
+            thread_local LocalLists lists;
+            return lists;
+        }
+
+        std::vector<T>& local();
+    };
+
+    template<typename T>
+    inline Cache<T>::~Cache() {
+        local_lists().lists.erase(id);
+        epoch().fetch_add(1, std::memory_order_release);
+    }
+
+    template<typename T>
+    inline std::vector<T>& Cache<T>::local() {
+        LocalLists &lists = local_lists();
+
+        uint64_t current = epoch().load(std::memory_order_acquire);
+        if (current != lists.seen_epoch) {
+            for (auto it = lists.lists.begin(); it != lists.lists.end();) {
+                it = it->second.owner.expired() ? lists.lists.erase(it) : std::next(it);
+            }
+            lists.seen_epoch = current;
+        }
+
+        Local &entry = lists.lists[id];
+        if (entry.owner.expired()) {
+            entry.owner = state;
+        }
+        return entry.items;
+    }
+
+    template<typename T>
+    template<typename Refill>
+    inline bool Cache<T>::acquire(T &item, Refill refill) {
+        std::vector<T> &items = local();
+
+        if (items.empty()) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            std::vector<T> &shared = state->items;
+            if (shared.empty()) {
+                refill(shared);
+            }
+            size_t count = std::min(batch_size, shared.size());
+            items.insert(items.end(), shared.end() - count, shared.end());
+            shared.resize(shared.size() - count);
+        }
+
+        if (items.empty()) {
+            return false;
+        }
+
+        item = items.back();
+        items.pop_back();
+        return true;
+    }
+
+    template<typename T>
+    inline void Cache<T>::release(const T &item) {
+        std::vector<T> &items = local();
+        items.push_back(item);
+
+        if (items.size() >= 2 * batch_size) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->items.insert(state->items.end(), items.end() - batch_size, items.end());
+            items.resize(items.size() - batch_size);
+        }
+    }
+}
+
+#endif // THREAD_CACHE_HPP
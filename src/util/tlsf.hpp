@@ -0,0 +1,309 @@
+/*
+Two-level segregated fit (TLSF) range allocator.
+
+Manages offsets inside a fixed size range without touching the memory itself,
+so it can be used to place sub-allocations inside a vk::DeviceMemory block.
+Allocation and free are O(1): free ranges are kept in size-class lists indexed
+by two bitmaps, and neighbouring ranges are merged on free.
+
+First level splits sizes by power of two, second level splits each power of two
+into SL_INDEX_COUNT linear steps. All sizes are rounded to the granularity
+given on construction.
+*/
+
+#ifndef TLSF_HPP
+#define TLSF_HPP
+
+#include <cstdint>
+#include <vector>
+#include <array>
+
+namespace tlsf {
+
+    static const uint32_t SL_INDEX_COUNT_LOG2 = 5;
+    static const uint32_t SL_INDEX_COUNT = 1 << SL_INDEX_COUNT_LOG2;
+    static const uint32_t FL_INDEX_COUNT = 64;
+    static const uint32_t NULL_NODE = UINT32_MAX;
+
+    struct Allocation {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t node;
+    };
+
+    class Allocator {
+        public:
+        Allocator() {};
+        Allocator(uint64_t size, uint64_t granularity);
+
+        /**
+         * Finds a free range of at least size bytes starting at a multiple of alignment.
+         * Returns false if no free range is large enough.
+         */
+        bool allocate(uint64_t size, uint64_t alignment, Allocation &allocation);
+        void free(uint32_t node);
+
+        uint64_t get_size() const { return size; }
+        uint64_t get_used() const { return used; }
+        uint32_t get_allocation_count() const { return allocation_count; }
+        bool empty() const { return allocation_count == 0; }
+        uint64_t get_largest_free() const;
+
+        private:
+        struct Node {
+            uint64_t offset;
+            uint64_t size;
+            uint32_t prev_phys;
+            uint32_t next_phys;
+            uint32_t prev_free;
+            uint32_t next_free;
+            bool free;
+        };
+
+        uint64_t size = 0;
+        uint64_t granularity = 1;
+        uint64_t used = 0;
+        uint32_t allocation_count = 0;
+
+        std::vector<Node> nodes;
+        std::vector<uint32_t> unused_nodes;
+
+        uint64_t fl_bitmap = 0;
+        std::array<uint32_t, FL_INDEX_COUNT> sl_bitmap = {};
+        std::array<uint32_t, FL_INDEX_COUNT * SL_INDEX_COUNT> free_lists;
+
+        uint32_t new_node(uint64_t offset, uint64_t size);
+        void release_node(uint32_t node);
+        void insert_free(uint32_t node);
+        void remove_free(uint32_t node);
+        uint32_t find_free(uint64_t size);
+        void split(uint32_t node, uint64_t size);
+    };
+
+    namespace detail {
+        inline uint32_t highest_bit(uint64_t value) {
+            return 63 - (uint32_t)__builtin_clzll(value);
+        }
+
+        inline uint32_t lowest_bit(uint64_t value) {
+            return (uint32_t)__builtin_ctzll(value);
+        }
+
+        // Size is given in units of granularity
+        inline void mapping(uint64_t units, uint32_t &fl, uint32_t &sl) {
+            if (units < SL_INDEX_COUNT) {
+                fl = 0;
+                sl = (uint32_t)units;
+            } else {
+                uint32_t bit = highest_bit(units);
+                fl = bit - SL_INDEX_COUNT_LOG2 + 1;
+                sl = (uint32_t)(units >> (bit - SL_INDEX_COUNT_LOG2)) - SL_INDEX_COUNT;
+            }
+        }
+
+        // Rounds up so that every range in the resulting list is large enough
+        inline uint64_t round_up_to_class(uint64_t units) {
+            if (units < SL_INDEX_COUNT) {
+                return units;
+            }
+            uint64_t step = (uint64_t)1 << (highest_bit(units) - SL_INDEX_COUNT_LOG2);
+            return units + step - 1;
+        }
+    }
+
+    // Walks the highest non-empty size class, other lists only hold smaller ranges
+    inline uint64_t Allocator::get_largest_free() const {
+        if (fl_bitmap == 0) {
+            return 0;
+        }
+        uint32_t fl = detail::highest_bit(fl_bitmap);
+        uint32_t sl = detail::highest_bit(sl_bitmap[fl]);
+
+        uint64_t largest = 0;
+        for (uint32_t node = free_lists[fl * SL_INDEX_COUNT + sl]; node != NULL_NODE; node = nodes[node].next_free) {
+            if (nodes[node].size > largest) {
+                largest = nodes[node].size;
+            }
+        }
+        return largest;
+    }
+
+    inline Allocator::Allocator(uint64_t size, uint64_t granularity)
+        : size((size / granularity) * granularity), granularity(granularity) {
+        free_lists.fill(NULL_NODE);
+        insert_free(new_node(0, this->size));
+    }
+
+    inline uint32_t Allocator::new_node(uint64_t offset, uint64_t size) {
+        uint32_t index;
+        if (!unused_nodes.empty()) {
+            index = unused_nodes.back();
+            unused_nodes.pop_back();
+        } else {
+            index = (uint32_t)nodes.size();
+            nodes.emplace_back();
+        }
+        nodes[index] = Node {offset, size, NULL_NODE, NULL_NODE, NULL_NODE, NULL_NODE, false};
+        return index;
+    }
+
+    inline void Allocator::release_node(uint32_t node) {
+        unused_nodes.push_back(node);
+    }
+
+    inline void Allocator::insert_free(uint32_t node) {
+        uint32_t fl, sl;
+        detail::mapping(nodes[node].size / granularity, fl, sl);
+
+        uint32_t &head = free_lists[fl * SL_INDEX_COUNT + sl];
+        nodes[node].free = true;
+        nodes[node].prev_free = NULL_NODE;
+        nodes[node].next_free = head;
+        if (head != NULL_NODE) {
+            nodes[head].prev_free = node;
+        }
+        head = node;
+
+        fl_bitmap |= (uint64_t)1 << fl;
+        sl_bitmap[fl] |= 1u << sl;
+    }
+
+    inline void Allocator::remove_free(uint32_t node) {
+        uint32_t fl, sl;
+        detail::mapping(nodes[node].size / granularity, fl, sl);
+
+        Node &n = nodes[node];
+        if (n.prev_free != NULL_NODE) {
+            nodes[n.prev_free].next_free = n.next_free;
+        } else {
+            free_lists[fl * SL_INDEX_COUNT + sl] = n.next_free;
+        }
+        if (n.next_free != NULL_NODE) {
+            nodes[n.next_free].prev_free = n.prev_free;
+        }
+        n.free = false;
+
+        if (free_lists[fl * SL_INDEX_COUNT + sl] == NULL_NODE) {
+            sl_bitmap[fl] &= ~(1u << sl);
+            if (sl_bitmap[fl] == 0) {
+                fl_bitmap &= ~((uint64_t)1 << fl);
+            }
+        }
+    }
+
+    inline uint32_t Allocator::find_free(uint64_t size) {
+        uint32_t fl, sl;
+        detail::mapping(detail::round_up_to_class(size / granularity), fl, sl);
+        if (fl >= FL_INDEX_COUNT) {
+            return NULL_NODE;
+        }
+
+        uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+        if (sl_map == 0) {
+            uint64_t fl_map = (fl + 1 < FL_INDEX_COUNT) ? fl_bitmap & (~(uint64_t)0 << (fl + 1)) : 0;
+            if (fl_map == 0) {
+                return NULL_NODE;
+            }
+            fl = detail::lowest_bit(fl_map);
+            sl_map = sl_bitmap[fl];
+        }
+        sl = detail::lowest_bit(sl_map);
+
+        return free_lists[fl * SL_INDEX_COUNT + sl];
+    }
+
+    // Cuts node down to size, the remainder is returned to the free lists
+    inline void Allocator::split(uint32_t node, uint64_t size) {
+        uint64_t remainder = nodes[node].size - size;
+        if (remainder == 0) {
+            return;
+        }
+
+        uint32_t rest = new_node(nodes[node].offset + size, remainder);
+        nodes[rest].prev_phys = node;
+        nodes[rest].next_phys = nodes[node].next_phys;
+        if (nodes[node].next_phys != NULL_NODE) {
+            nodes[nodes[node].next_phys].prev_phys = rest;
+        }
+        nodes[node].next_phys = rest;
+        nodes[node].size = size;
+
+        insert_free(rest);
+    }
+
+    inline bool Allocator::allocate(uint64_t size, uint64_t alignment, Allocation &allocation) {
+        if (size == 0) {
+            size = 1;
+        }
+        if (alignment < granularity) {
+            alignment = granularity;
+        }
+        size = ((size + granularity - 1) / granularity) * granularity;
+
+        // Over-allocate so that any range found can be aligned
+        uint64_t padded_size = size + alignment - granularity;
+        if (padded_size > this->size) {
+            return false;
+        }
+
+        uint32_t node = find_free(padded_size);
+        if (node == NULL_NODE) {
+            return false;
+        }
+
+        remove_free(node);
+
+        uint64_t aligned_offset = ((nodes[node].offset + alignment - 1) / alignment) * alignment;
+        uint64_t padding = aligned_offset - nodes[node].offset;
+        if (padding > 0) {
+            // Leading padding becomes its own free range, previous neighbour is never free
+            uint32_t front = node;
+            split(front, padding);
+            node = nodes[front].next_phys;
+            remove_free(node);
+            insert_free(front);
+        }
+
+        split(node, size);
+
+        used += nodes[node].size;
+        ++allocation_count;
+
+        allocation.offset = nodes[node].offset;
+        allocation.size = nodes[node].size;
+        allocation.node = node;
+        return true;
+    }
+
+    inline void Allocator::free(uint32_t node) {
+        used -= nodes[node].size;
+        --allocation_count;
+
+        uint32_t prev = nodes[node].prev_phys;
+        if (prev != NULL_NODE && nodes[prev].free) {
+            remove_free(prev);
+            nodes[prev].size += nodes[node].size;
+            nodes[prev].next_phys = nodes[node].next_phys;
+            if (nodes[node].next_phys != NULL_NODE) {
+                nodes[nodes[node].next_phys].prev_phys = prev;
+            }
+            release_node(node);
+            node = prev;
+        }
+
+        uint32_t next = nodes[node].next_phys;
+        if (next != NULL_NODE && nodes[next].free) {
+            remove_free(next);
+            nodes[node].size += nodes[next].size;
+            nodes[node].next_phys = nodes[next].next_phys;
+            if (nodes[next].next_phys != NULL_NODE) {
+                nodes[nodes[next].next_phys].prev_phys = node;
+            }
+            release_node(next);
+        }
+
+        insert_free(node);
+    }
+}
+
+#endif // TLSF_HPP
@@ -0,0 +1,109 @@
+#include "vulkan_device.hpp"
+
+namespace vk_mem {
+
+    VulkanDevice::VulkanDevice(vk::PhysicalDevice *p_physical_device, vk::Device *p_device, const bool memory_budget)
+        : p_physical_device(p_physical_device), p_device(p_device), memory_budget(memory_budget) {}
+
+    vk::PhysicalDeviceProperties VulkanDevice::get_properties() {
+        return p_physical_device->getProperties();
+    }
+
+    vk::PhysicalDeviceMemoryProperties VulkanDevice::get_memory_properties() {
+        return p_physical_device->getMemoryProperties();
+    }
+
+    bool VulkanDevice::get_memory_budget(vk::DeviceSize *budget, vk::DeviceSize *usage) {
+        #ifdef VK_EXT_memory_budget
+        if (memory_budget) {
+            vk::PhysicalDeviceMemoryBudgetPropertiesEXT budget_properties;
+            vk::PhysicalDeviceMemoryProperties2 properties;
+            properties.pNext = &budget_properties;
+            p_physical_device->getMemoryProperties2(&properties);
+            for (uint32_t i = 0; i < properties.memoryProperties.memoryHeapCount; i++) {
+                budget[i] = budget_properties.heapBudget[i];
+                usage[i] = budget_properties.heapUsage[i];
+            }
+            return true;
+        }
+        #endif
+        return false;
+    }
+
+    vk::Buffer VulkanDevice::create_buffer(const vk::BufferCreateInfo &create_info) {
+        return p_device->createBuffer(create_info);
+    }
+
+    void VulkanDevice::destroy_buffer(const vk::Buffer &buffer) {
+        p_device->destroyBuffer(buffer);
+    }
+
+    vk::MemoryRequirements VulkanDevice::get_buffer_memory_requirements(const vk::Buffer &buffer, vk::MemoryDedicatedRequirements &dedicated_reqs) {
+        vk::MemoryRequirements2 mem_reqs2;
+        mem_reqs2.pNext = &dedicated_reqs;
+        vk::BufferMemoryRequirementsInfo2 reqs_info(buffer);
+        p_device->getBufferMemoryRequirements2(&reqs_info, &mem_reqs2);
+        return mem_reqs2.memoryRequirements;
+    }
+
+    void VulkanDevice::bind_buffer_memory(const vk::Buffer &buffer, const vk::DeviceMemory &memory, const vk::DeviceSize offset) {
+        p_device->bindBufferMemory(buffer, memory, offset);
+    }
+
+    vk::Image VulkanDevice::create_image(const vk::ImageCreateInfo &create_info) {
+        return p_device->createImage(create_info);
+    }
+
+    void VulkanDevice::destroy_image(const vk::Image &image) {
+        p_device->destroyImage(image);
+    }
+
+    vk::MemoryRequirements VulkanDevice::get_image_memory_requirements(const vk::Image &image, vk::MemoryDedicatedRequirements &dedicated_reqs) {
+        vk::MemoryRequirements2 mem_reqs2;
+        mem_reqs2.pNext = &dedicated_reqs;
+        vk::ImageMemoryRequirementsInfo2 reqs_info(image);
+        p_device->getImageMemoryRequirements2(&reqs_info, &mem_reqs2);
+        return mem_reqs2.memoryRequirements;
+    }
+
+    void VulkanDevice::bind_image_memory(const vk::Image &image, const vk::DeviceMemory &memory, const vk::DeviceSize offset) {
+        p_device->bindImageMemory(image, memory, offset);
+    }
+
+    vk::DeviceMemory VulkanDevice::allocate_memory(const vk::MemoryAllocateInfo &alloc_info) {
+        return p_device->allocateMemory(alloc_info);
+    }
+
+    void VulkanDevice::free_memory(const vk::DeviceMemory &memory) {
+        p_device->freeMemory(memory);
+    }
+
+    void* VulkanDevice::map_memory(const vk::DeviceMemory &memory) {
+        return p_device->mapMemory(memory, 0, VK_WHOLE_SIZE);
+    }
+
+    void VulkanDevice::unmap_memory(const vk::DeviceMemory &memory) {
+        p_device->unmapMemory(memory);
+    }
+
+    void VulkanDevice::flush_memory(const vk::MappedMemoryRange &range) {
+        p_device->flushMappedMemoryRanges(range);
+    }
+
+    void VulkanDevice::invalidate_memory(const vk::MappedMemoryRange &range) {
+        p_device->invalidateMappedMemoryRanges(range);
+    }
+
+    vk::DeviceSize VulkanDevice::get_memory_commitment(const vk::DeviceMemory &memory) {
+        return p_device->getMemoryCommitment(memory);
+    }
+
+    void VulkanDevice::copy_buffer(vk::CommandBuffer &command_buffer, const vk::Buffer &src, const vk::Buffer &dst, const vk::BufferCopy &region) {
+        command_buffer.copyBuffer(src, dst, region);
+    }
+
+    void VulkanDevice::memory_barrier(vk::CommandBuffer &command_buffer, const vk::PipelineStageFlags src_stages, const vk::PipelineStageFlags dst_stages, const vk::MemoryBarrier &barrier) {
+        command_buffer.pipelineBarrier(src_stages, dst_stages, vk::DependencyFlags(), barrier, nullptr, nullptr);
+    }
+
+}
@@ -0,0 +1,86 @@
+#ifndef VULKAN_DEVICE_HPP
+#define VULKAN_DEVICE_HPP
+
+#include "includes.hpp"
+
+namespace vk_mem {
+
+    /**
+     * Device calls made by the Manager. VulkanDevice forwards them to the driver, other
+     * implementations can simulate memory types and heaps to run the Manager without a GPU.
+     *
+     * allocate_memory throws when the heap is exhausted, like vk::Device::allocateMemory.
+     */
+    class Device {
+        public:
+        virtual ~Device() {};
+
+        virtual vk::PhysicalDeviceProperties get_properties() = 0;
+        virtual vk::PhysicalDeviceMemoryProperties get_memory_properties() = 0;
+        // Fills budget and usage per heap, returns false if VK_EXT_memory_budget is unavailable
+        virtual bool get_memory_budget(vk::DeviceSize *budget, vk::DeviceSize *usage) = 0;
+
+        virtual vk::Buffer create_buffer(const vk::BufferCreateInfo &create_info) = 0;
+        virtual void destroy_buffer(const vk::Buffer &buffer) = 0;
+        virtual vk::MemoryRequirements get_buffer_memory_requirements(const vk::Buffer &buffer, vk::MemoryDedicatedRequirements &dedicated_reqs) = 0;
+        virtual void bind_buffer_memory(const vk::Buffer &buffer, const vk::DeviceMemory &memory, const vk::DeviceSize offset) = 0;
+
+        virtual vk::Image create_image(const vk::ImageCreateInfo &create_info) = 0;
+        virtual void destroy_image(const vk::Image &image) = 0;
+        virtual vk::MemoryRequirements get_image_memory_requirements(const vk::Image &image, vk::MemoryDedicatedRequirements &dedicated_reqs) = 0;
+        virtual void bind_image_memory(const vk::Image &image, const vk::DeviceMemory &memory, const vk::DeviceSize offset) = 0;
+
+        virtual vk::DeviceMemory allocate_memory(const vk::MemoryAllocateInfo &alloc_info) = 0;
+        virtual void free_memory(const vk::DeviceMemory &memory) = 0;
+        // Maps the whole allocation
+        virtual void* map_memory(const vk::DeviceMemory &memory) = 0;
+        virtual void unmap_memory(const vk::DeviceMemory &memory) = 0;
+        virtual void flush_memory(const vk::MappedMemoryRange &range) = 0;
+        virtual void invalidate_memory(const vk::MappedMemoryRange &range) = 0;
+        // Bytes actually backed by physical memory, only meaningful for lazily allocated types
+        virtual vk::DeviceSize get_memory_commitment(const vk::DeviceMemory &memory) = 0;
+
+        // Command recording used by defragmentation
+        virtual void copy_buffer(vk::CommandBuffer &command_buffer, const vk::Buffer &src, const vk::Buffer &dst, const vk::BufferCopy &region) = 0;
+        virtual void memory_barrier(vk::CommandBuffer &command_buffer, const vk::PipelineStageFlags src_stages, const vk::PipelineStageFlags dst_stages, const vk::MemoryBarrier &barrier) = 0;
+    };
+
+    class VulkanDevice : public Device {
+        public:
+        // memory_budget must only be set if VK_EXT_memory_budget was enabled on the device
+        VulkanDevice(vk::PhysicalDevice *p_physical_device, vk::Device *p_device, const bool memory_budget = false);
+
+        vk::PhysicalDeviceProperties get_properties() override;
+        vk::PhysicalDeviceMemoryProperties get_memory_properties() override;
+        bool get_memory_budget(vk::DeviceSize *budget, vk::DeviceSize *usage) override;
+
+        vk::Buffer create_buffer(const vk::BufferCreateInfo &create_info) override;
+        void destroy_buffer(const vk::Buffer &buffer) override;
+        vk::MemoryRequirements get_buffer_memory_requirements(const vk::Buffer &buffer, vk::MemoryDedicatedRequirements &dedicated_reqs) override;
+        void bind_buffer_memory(const vk::Buffer &buffer, const vk::DeviceMemory &memory, const vk::DeviceSize offset) override;
+
+        vk::Image create_image(const vk::ImageCreateInfo &create_info) override;
+        void destroy_image(const vk::Image &image) override;
+        vk::MemoryRequirements get_image_memory_requirements(const vk::Image &image, vk::MemoryDedicatedRequirements &dedicated_reqs) override;
+        void bind_image_memory(const vk::Image &image, const vk::DeviceMemory &memory, const vk::DeviceSize offset) override;
+
+        vk::DeviceMemory allocate_memory(const vk::MemoryAllocateInfo &alloc_info) override;
+        void free_memory(const vk::DeviceMemory &memory) override;
+        void* map_memory(const vk::DeviceMemory &memory) override;
+        void unmap_memory(const vk::DeviceMemory &memory) override;
+        void flush_memory(const vk::MappedMemoryRange &range) override;
+        void invalidate_memory(const vk::MappedMemoryRange &range) override;
+        vk::DeviceSize get_memory_commitment(const vk::DeviceMemory &memory) override;
+
+        void copy_buffer(vk::CommandBuffer &command_buffer, const vk::Buffer &src, const vk::Buffer &dst, const vk::BufferCopy &region) override;
+        void memory_barrier(vk::CommandBuffer &command_buffer, const vk::PipelineStageFlags src_stages, const vk::PipelineStageFlags dst_stages, const vk::MemoryBarrier &barrier) override;
+
+        private:
+        vk::PhysicalDevice *p_physical_device;
+        vk::Device *p_device;
+        bool memory_budget;
+    };
+
+}
+
+#endif // VULKAN_DEVICE_HPP
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <cstring>
 
 namespace vk_help {
     #ifdef WINDOWS
@@ -72,9 +73,44 @@ namespace vk_help {
         return static_cast<uint32_t>(queueFamilyIndex);
     }
 
-    vk::Device create_device_khr(const vk::PhysicalDevice &physical_device, uint32_t queue_family) {
+    uint32_t pick_transfer_queue_family(const vk::PhysicalDevice &physical_device, uint32_t fallback) {
+
+        std::vector<vk::QueueFamilyProperties> queueFamilyProperties = physical_device.getQueueFamilyProperties();
+
+        for (uint32_t i = 0; i < queueFamilyProperties.size(); i++) {
+            auto flags = queueFamilyProperties[i].queueFlags;
+            if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute))) {
+                return i;
+            }
+        }
+
+        return fallback;
+    }
+
+    bool has_device_extension(const vk::PhysicalDevice &physical_device, const char *extension) {
+        std::vector<vk::ExtensionProperties> properties = physical_device.enumerateDeviceExtensionProperties();
+        return std::any_of(properties.begin(), properties.end(),
+            [extension](vk::ExtensionProperties const& p) { return std::strcmp(p.extensionName, extension) == 0; });
+    }
+
+    bool supports_linear_blit(const vk::PhysicalDevice &physical_device, const vk::Format &format) {
+        vk::FormatFeatureFlags required = vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+        return (physical_device.getFormatProperties(format).optimalTilingFeatures & required) == required;
+    }
+
+    bool supports_sampled_format(const vk::PhysicalDevice &physical_device, const vk::Format &format) {
+        return bool(physical_device.getFormatProperties(format).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage);
+    }
+
+    vk::Device create_device_khr(const vk::PhysicalDevice &physical_device, const std::vector<uint32_t> &queue_families) {
         std::vector<char const*> device_level_extensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
+        #ifdef VK_EXT_memory_budget
+        if (has_device_extension(physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+            device_level_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+        #endif
+
         #ifdef DEBUG
         if (check_env("VK_INSTANCE_LAYERS")) {
             device_level_extensions.push_back(VK_EXT_DEBUG_MARKER_EXTENSION_NAME);
@@ -82,16 +118,23 @@ namespace vk_help {
         #endif
 
         float queuePriority = 0.0f;
-        vk::DeviceQueueCreateInfo deviceQueueCreateInfo(
-            vk::DeviceQueueCreateFlags(),
-            queue_family,                   // Queue Family
-            1,                              // Queue count
-            &queuePriority                  // Queue priority
-            );
+        std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos;
+        for (uint32_t queue_family : queue_families) {
+            if (std::any_of(deviceQueueCreateInfos.begin(), deviceQueueCreateInfos.end(),
+                [queue_family](vk::DeviceQueueCreateInfo const& info) { return info.queueFamilyIndex == queue_family; })) {
+                continue;
+            }
+            deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo(
+                vk::DeviceQueueCreateFlags(),
+                queue_family,                   // Queue Family
+                1,                              // Queue count
+                &queuePriority                  // Queue priority
+                ));
+        }
         vk::DeviceCreateInfo deviceCreateInfo(
             vk::DeviceCreateFlags(),
-            1,                              // Queue create info count
-            &deviceQueueCreateInfo,         // Queue create info
+            deviceQueueCreateInfos.size(),  // Queue create info count
+            &deviceQueueCreateInfos[0],     // Queue create info
             0,                              // Enabled layer count
             nullptr,                        // Enabled layers
             device_level_extensions.size(), // Enabled extensions count
@@ -144,10 +187,14 @@ namespace vk_help {
         file.read(buffer.data(), size);
         file.close();
 
+        return create_shader_module(device, buffer.data(), size);
+    }
+
+    vk::ShaderModule create_shader_module(const vk::Device &device, const void *code, const size_t size) {
         vk::ShaderModuleCreateInfo create_info(
             vk::ShaderModuleCreateFlags(),
             size, // Code size
-            reinterpret_cast<const uint32_t*>(buffer.data()) // Code
+            static_cast<const uint32_t*>(code) // Code
         );
 
         vk::ShaderModule shader = device.createShaderModule(create_info);
@@ -261,18 +308,4 @@ namespace vk_help {
 
         return swapChainImageViews;
     }
-
-    
-
-    image_container load_image(std::string path, int format) {
-        image_container container;
-
-        container.image = stbi_load(path.c_str(), &container.width, &container.height, &container.channels, format);
-
-        if (!container.image) {
-            throw std::runtime_error("Failed to load image");
-        }
-
-        return container;
-    }
 }
\ No newline at end of file
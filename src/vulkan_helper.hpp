@@ -10,33 +10,27 @@ namespace vk_help {
 
     uint32_t pick_queue_family(const vk::PhysicalDevice &physical_device, const vk::QueueFlags flags = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute);
 
-    vk::Device create_device_khr(const vk::PhysicalDevice &physical_device, uint32_t queue_family);
+    // Returns a family supporting transfers but not graphics or compute, or fallback if there is none
+    uint32_t pick_transfer_queue_family(const vk::PhysicalDevice &physical_device, uint32_t fallback);
+
+    bool has_device_extension(const vk::PhysicalDevice &physical_device, const char *extension);
+
+    // Whether optimally tiled images of the format can generate their mips with linear filtered blits
+    bool supports_linear_blit(const vk::PhysicalDevice &physical_device, const vk::Format &format);
+    bool supports_sampled_format(const vk::PhysicalDevice &physical_device, const vk::Format &format);
+
+    // Also enables VK_EXT_memory_budget when the device supports it
+    vk::Device create_device_khr(const vk::PhysicalDevice &physical_device, const std::vector<uint32_t> &queue_families);
 
     std::tuple<glfw::GLFWwindow*, vk::SurfaceKHR> create_glfw_surface_khr(const vk::PhysicalDevice &physical_device, const vk::Instance &instance, uint32_t queue_family, const vk::Extent2D &surface_dimensions, const std::string &window_name);
 
     vk::ShaderModule load_precompiled_shader(const vk::Device &device, const std::string &filename);
+    // code must be aligned to 4 bytes
+    vk::ShaderModule create_shader_module(const vk::Device &device, const void *code, const size_t size);
 
     std::tuple<vk::SwapchainKHR, vk::Format> create_standard_swapchain(const vk::PhysicalDevice &physical_device, const vk::Device &device, const vk::SurfaceKHR &surface, vk::Extent2D dimensions, glfw::GLFWwindow *window, uint32_t queue_family);
 
     std::vector<vk::ImageView> create_swapchain_image_views(const vk::Device &device, const std::vector<vk::Image> &swapChainImages, const vk::Format &swapChainImageFormat);
-
-    struct image_container {
-        int width, height, channels;
-        stbi_uc *image;
-
-        image_container() {}
-
-        ~image_container() {
-            stbi_image_free(image);
-        }
-
-        image_container(image_container&&) = default;
-        image_container& operator=(image_container&&) = default;
-
-        image_container(const image_container&) = delete;
-    };
-
-    image_container load_image(std::string path, int format = STBI_rgb_alpha);
 }
 
 #endif // VULKAN_HELPER_HPP
\ No newline at end of file
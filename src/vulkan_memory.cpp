@@ -1,18 +1,43 @@
 #include "vulkan_memory.hpp"
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace vk_mem {
-    uint32_t Manager::find_memory_type(const vk::MemoryRequirements &mem_req, const vk::MemoryPropertyFlags property_flags) {
-        auto properties = p_physical_device->getMemoryProperties();
+    inline int count_flags(const vk::MemoryPropertyFlags flags) {
+        return __builtin_popcount((VkMemoryPropertyFlags)flags);
+    }
 
-        for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
-            if ((mem_req.memoryTypeBits & (1 << i))
-                && ((properties.memoryTypes[i].propertyFlags & property_flags) == property_flags)) {
-                    return i;
+    inline alloc_trace::Dedicated trace_dedicated(const vk::MemoryDedicatedRequirements &dedicated_reqs) {
+        if (dedicated_reqs.requiresDedicatedAllocation) {
+            return alloc_trace::Dedicated::Required;
+        }
+        return dedicated_reqs.prefersDedicatedAllocation ? alloc_trace::Dedicated::Preferred : alloc_trace::Dedicated::None;
+    }
+
+    uint32_t Manager::find_memory_type(const vk::MemoryRequirements &mem_req, const MemoryPreference &preference) {
+        uint32_t best_type = UINT32_MAX;
+        int best_score = 0;
+        for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+            vk::MemoryPropertyFlags flags = memory_properties.memoryTypes[i].propertyFlags;
+            if (!(mem_req.memoryTypeBits & (1 << i)) || (flags & preference.required) != preference.required) {
+                continue;
             }
+
+            // Ties go to the lower index, types are ordered by performance
+            int score = count_flags(flags & preference.preferred) - count_flags(flags & preference.avoided);
+            if (best_type == UINT32_MAX || score > best_score) {
+                best_type = i;
+                best_score = score;
+            }
+        }
+
+        if (best_type == UINT32_MAX) {
+            throw std::runtime_error("Unable to allocate memory");
         }
-        throw std::runtime_error("Unable to allocate memory");
+        return best_type;
     }
 
     template<typename T>
@@ -20,34 +45,35 @@ namespace vk_mem {
         return ((val + step - 1) / step) * step;
     }
 
-    std::string memory_type_to_string(uint32_t type) {
+    std::string memory_type_to_string(const vk::MemoryPropertyFlags property_flags) {
+        VkMemoryPropertyFlags flags = (VkMemoryPropertyFlags)property_flags;
         std::string ret = "";
         bool multiple_flags = false;
-        if ((type & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0) {
+        if ((flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0) {
             ret += "DeviceLocal";
             multiple_flags = true;
         }
-        if ((type & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0) {
+        if ((flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0) {
             if (multiple_flags) ret += "+";
             ret += "HostCached";
             multiple_flags = true;
         }
-        if ((type & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0) {
+        if ((flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0) {
             if (multiple_flags) ret += "+";
             ret += "HostCoherent";
             multiple_flags = true;
         }
-        if ((type & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0) {
+        if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0) {
             if (multiple_flags) ret += "+";
             ret += "HostVisible";
             multiple_flags = true;
         }
-        if ((type & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0) {
+        if ((flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0) {
             if (multiple_flags) ret += "+";
             ret += "Lazy";
             multiple_flags = true;
         }
-        if ((type & VK_MEMORY_PROPERTY_PROTECTED_BIT) != 0) {
+        if ((flags & VK_MEMORY_PROPERTY_PROTECTED_BIT) != 0) {
             if (multiple_flags) ret += "+";
             ret += "Protected";
             multiple_flags = true;
@@ -56,16 +82,12 @@ namespace vk_mem {
     }
 
     std::ostream& operator<< (std::ostream& stream, const BufferHandle& handle) {
-        stream << "Buffer<";
-        stream << memory_type_to_string(handle.type);
-        stream << ">[" << handle.offset / MEMORY_SUBBLOCK_SIZE << "]";
+        stream << "Buffer[" << handle.index << ":" << handle.generation << "]";
         return stream;
     }
 
     std::ostream& operator<< (std::ostream& stream, const ImageHandle& handle) {
-        stream << "Image<";
-        stream << memory_type_to_string(handle.type);
-        stream << ">[" << handle.offset / MEMORY_SUBBLOCK_SIZE << "]";
+        stream << "Image[" << handle.index << ":" << handle.generation << "]";
         return stream;
     }
 
@@ -85,7 +107,128 @@ namespace vk_mem {
         return this->internal_image;
     }
 
-    BufferHandle Manager::create_buffer(const uint32_t size, const vk::BufferUsageFlags usage_flags, const vk::MemoryPropertyFlags properties) {
+    vk::DeviceSize Manager::next_block_size(const uint32_t memory_type, const uint32_t pool, const vk::DeviceSize required) {
+        const BlockSizeConfig &config = block_sizes[memory_properties.memoryTypes[memory_type].heapIndex];
+
+        // Each new block doubles the largest one so far, few blocks are needed as demand rises
+        vk::DeviceSize block_size = config.initial_block_size;
+        for (auto &block : memory_blocks[pool]) {
+            if (!block->dedicated) {
+                block_size = std::max(block_size, std::min(block->size * 2, config.max_block_size));
+            }
+        }
+        while (block_size < required && block_size < config.max_block_size) {
+            block_size *= 2;
+        }
+        return std::min(block_size, config.max_block_size);
+    }
+
+    MemoryBlock* Manager::allocate(const vk::MemoryRequirements &mem_reqs, const uint32_t memory_type, const uint32_t pool, const vk::MemoryDedicatedAllocateInfo *dedicated_info, tlsf::Allocation &allocation) {
+        const BlockSizeConfig &config = block_sizes[memory_properties.memoryTypes[memory_type].heapIndex];
+        vk::DeviceSize required = mem_reqs.size + mem_reqs.alignment;
+
+        bool dedicated = dedicated_info != nullptr
+            || mem_reqs.size > config.dedicated_threshold
+            || required > config.max_block_size;
+
+        std::lock_guard<std::mutex> lock(sync->blocks);
+        auto &blocks = memory_blocks[pool];
+
+        if (!dedicated) {
+            for (auto &block : blocks) {
+                if (!block->dedicated && block->allocator.allocate(mem_reqs.size, mem_reqs.alignment, allocation)) {
+                    track_peak(memory_type);
+                    return block.get();
+                }
+            }
+        }
+
+        // Dedicated allocations must match the requirements exactly
+        vk::DeviceSize block_size = dedicated ? mem_reqs.size : next_block_size(memory_type, pool, required);
+        vk::MemoryAllocateInfo alloc_info(block_size, memory_type);
+        alloc_info.pNext = dedicated_info;
+
+        auto mem_block = std::make_unique<MemoryBlock>();
+        while (true) {
+            try {
+                mem_block->memory = device->allocate_memory(alloc_info);
+                break;
+            } catch (...) {
+                // Small heaps may not fit a full block, retry with smaller ones
+                if (dedicated || block_size / 2 < required) {
+                    std::cerr << "Unable to allocate memory" << std::endl;
+                    return nullptr;
+                }
+                block_size /= 2;
+                alloc_info.allocationSize = block_size;
+            }
+        }
+        mem_block->size = block_size;
+        mem_block->memory_type = memory_type;
+        mem_block->dedicated = dedicated;
+        mem_block->allocator = tlsf::Allocator(integer_step(block_size, MEMORY_SUBBLOCK_SIZE), MEMORY_SUBBLOCK_SIZE);
+        mem_block->mapped = nullptr;
+        if (memory_properties.memoryTypes[memory_type].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+            mem_block->mapped = device->map_memory(mem_block->memory);
+        }
+        #ifdef DEBUG
+        std::cout << "Allocating " << (dedicated ? "dedicated " : "") << "memory of type <" << memory_type_to_string(memory_properties.memoryTypes[memory_type].propertyFlags) << "> and size " << block_size / 1048576.0f << "MB" << std::endl;
+        #endif
+
+        // A dedicated block starts at offset 0, which satisfies any alignment
+        mem_block->allocator.allocate(mem_reqs.size, dedicated ? 1 : mem_reqs.alignment, allocation);
+        blocks.push_back(std::move(mem_block));
+        defragment_pending = true;
+        track_peak(memory_type);
+        return blocks.back().get();
+    }
+
+    void Manager::release_dedicated(MemoryBlock *block) {
+        for (auto &[pool, blocks] : memory_blocks) {
+            for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+                if (it->get() == block) {
+                    release_block(*block);
+                    blocks.erase(it);
+                    return;
+                }
+            }
+        }
+    }
+
+    // The heap peak is taken from the current use of all its types, peaks of different types don't add up
+    void Manager::track_peak(const uint32_t memory_type) {
+        const uint32_t heap = memory_properties.memoryTypes[memory_type].heapIndex;
+        vk::DeviceSize used = 0;
+        vk::DeviceSize heap_used = 0;
+        for (auto &[pool, blocks] : memory_blocks) {
+            for (auto &block : blocks) {
+                if (block->memory_type == memory_type) {
+                    used += block->allocator.get_used();
+                }
+                if (memory_properties.memoryTypes[block->memory_type].heapIndex == heap) {
+                    heap_used += block->allocator.get_used();
+                }
+            }
+        }
+        peak_used[memory_type] = std::max(peak_used[memory_type], used);
+        heap_peak_used[heap] = std::max(heap_peak_used[heap], heap_used);
+    }
+
+    uint32_t Manager::block_pool(const uint32_t memory_type, const bool optimal_image) const {
+        // Offsets and sizes are multiples of MEMORY_SUBBLOCK_SIZE, which already keeps linear and
+        // optimal resources on separate pages unless the device uses a coarser granularity
+        if (optimal_image && limits.bufferImageGranularity > MEMORY_SUBBLOCK_SIZE) {
+            return memory_type | OPTIMAL_IMAGE_POOL;
+        }
+        return memory_type;
+    }
+
+    BufferHandle Manager::create_buffer(const vk::DeviceSize size, const vk::BufferUsageFlags usage_flags, const MemoryPreference &preference) {
+        return create_block_buffer(size, usage_flags, preference, false);
+    }
+
+    // Pinned buffers are published pinned, defragmentation never sees them movable
+    BufferHandle Manager::create_block_buffer(const vk::DeviceSize size, const vk::BufferUsageFlags usage_flags, const MemoryPreference &preference, const bool pinned) {
         vk::BufferCreateInfo create_info(
             vk::BufferCreateFlags(),
             size,
@@ -93,338 +236,1045 @@ namespace vk_mem {
             vk::SharingMode::eExclusive
         );
 
-        vk::Buffer buffer = p_device->createBuffer(create_info);
+        vk::Buffer buffer = device->create_buffer(create_info);
 
-        vk::MemoryRequirements mem_reqs = p_device->getBufferMemoryRequirements(buffer);
+        vk::MemoryDedicatedRequirements dedicated_reqs;
+        vk::MemoryRequirements mem_reqs = device->get_buffer_memory_requirements(buffer, dedicated_reqs);
 
-        uint32_t memory_type = find_memory_type(mem_reqs, properties);
+        uint32_t memory_type = find_memory_type(mem_reqs, preference);
 
-        MemoryBlock *mem_block = &memory_blocks[memory_type];
+        vk::MemoryDedicatedAllocateInfo dedicated_info(nullptr, buffer);
+        bool wants_dedicated = dedicated_reqs.prefersDedicatedAllocation || dedicated_reqs.requiresDedicatedAllocation;
 
-        vk::DeviceSize mem_block_index = 0;
+        uint32_t pool = block_pool(memory_type, false);
+        tlsf::Allocation allocation;
+        MemoryBlock *mem_block;
+        try {
+            mem_block = allocate(mem_reqs, memory_type, pool, wants_dedicated ? &dedicated_info : nullptr, allocation);
+        } catch (...) {
+            device->destroy_buffer(buffer);
+            throw;
+        }
 
-        while(true) {
-            if (!mem_block->memory) {
-                vk::MemoryAllocateInfo alloc_info(MEMORY_BLOCK_SIZE, memory_type);
-                try {
-                    mem_block->memory = p_device->allocateMemory(alloc_info);
-                } catch (...) {
-                    std::cerr << "Unable to allocate memory" << std::endl;
-                    break;
+        if (mem_block == nullptr) {
+            device->destroy_buffer(buffer);
+            throw std::runtime_error("Unable to allocate buffer");
+        }
+
+        device->bind_buffer_memory(buffer, mem_block->memory, allocation.offset);
+
+        uint32_t index = new_record(mem_block, memory_type, allocation.offset);
+        AllocationRecord &record = record_at(index);
+        record.buffer.internal_buffer = buffer;
+        record.buffer.offset = allocation.offset;
+        record.buffer.buffer_offset = 0;
+        record.buffer.size = size;
+        record.buffer.allocation = allocation.node;
+        record.usage = usage_flags;
+        record.pinned = pinned;
+        publish_record(index);
+
+        std::shared_ptr<alloc_trace::Writer> writer = active_trace();
+        if (writer) {
+            alloc_trace::Event event = {};
+            event.op = (uint8_t)alloc_trace::Op::CreateBuffer;
+            event.flags = mem_block->dedicated ? alloc_trace::FLAG_DEDICATED : 0;
+            event.dedicated = (uint8_t)trace_dedicated(dedicated_reqs);
+            event.usage = (VkBufferUsageFlags)usage_flags;
+            event.pool = pool;
+            event.size = mem_reqs.size;
+            event.alignment = mem_reqs.alignment;
+            trace_event(*writer, event, index);
+        }
+
+        return BufferHandle {index, record.generation};
+    }
+
+    ImageHandle Manager::create_image(const vk::ImageCreateInfo &create_info, const MemoryPreference &preference) {
+        vk::Image image = device->create_image(create_info);
+
+        vk::MemoryDedicatedRequirements dedicated_reqs;
+        vk::MemoryRequirements mem_reqs = device->get_image_memory_requirements(image, dedicated_reqs);
+
+        uint32_t memory_type;
+        try {
+            memory_type = find_memory_type(mem_reqs, preference);
+        } catch (...) {
+            device->destroy_image(image);
+            throw;
+        }
+        bool lazy = (bool)(memory_properties.memoryTypes[memory_type].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated);
+
+        // Render targets and other large images are often preferred dedicated by the driver
+        vk::MemoryDedicatedAllocateInfo dedicated_info(image, nullptr);
+        bool wants_dedicated = dedicated_reqs.prefersDedicatedAllocation || dedicated_reqs.requiresDedicatedAllocation || lazy;
+
+        bool optimal = create_info.tiling == vk::ImageTiling::eOptimal;
+        uint32_t pool = block_pool(memory_type, optimal);
+        tlsf::Allocation allocation;
+        MemoryBlock *mem_block;
+        try {
+            mem_block = allocate(mem_reqs, memory_type, pool, wants_dedicated ? &dedicated_info : nullptr, allocation);
+        } catch (...) {
+            device->destroy_image(image);
+            throw;
+        }
+
+        if (mem_block == nullptr) {
+            device->destroy_image(image);
+            throw std::runtime_error("Unable to allocate image");
+        }
+
+        device->bind_image_memory(image, mem_block->memory, allocation.offset);
+
+        uint32_t index = new_record(mem_block, memory_type, allocation.offset);
+        AllocationRecord &record = record_at(index);
+        record.is_image = true;
+        record.image.internal_image = image;
+        record.image.offset = allocation.offset;
+        record.image.size = mem_reqs.size;
+        record.image.allocation = allocation.node;
+        publish_record(index);
+
+        std::shared_ptr<alloc_trace::Writer> writer = active_trace();
+        if (writer) {
+            alloc_trace::Event event = {};
+            event.op = (uint8_t)alloc_trace::Op::CreateImage;
+            event.flags = (mem_block->dedicated ? alloc_trace::FLAG_DEDICATED : 0) | (optimal ? alloc_trace::FLAG_OPTIMAL_IMAGE : 0);
+            event.dedicated = (uint8_t)trace_dedicated(dedicated_reqs);
+            event.usage = (VkImageUsageFlags)create_info.usage;
+            event.pool = pool;
+            event.size = mem_reqs.size;
+            event.alignment = mem_reqs.alignment;
+            trace_event(*writer, event, index);
+        }
+
+        return ImageHandle {index, record.generation};
+    }
+
+    ImageHandle Manager::create_transient_attachment(const vk::Format format, const vk::Extent2D &extent, const vk::ImageUsageFlags usage, const vk::SampleCountFlagBits samples) {
+        const vk::ImageUsageFlags attachment_usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eInputAttachment;
+        if (!(usage & attachment_usage) || (usage & ~attachment_usage)) {
+            throw std::runtime_error("Transient attachments only allow attachment usage");
+        }
+
+        vk::ImageCreateInfo create_info(
+            vk::ImageCreateFlags(),
+            vk::ImageType::e2D,
+            format,
+            vk::Extent3D(extent.width, extent.height, 1),
+            1,                                              // Mip levels
+            1,                                              // Array layers
+            samples,
+            vk::ImageTiling::eOptimal,
+            usage | vk::ImageUsageFlagBits::eTransientAttachment,
+            vk::SharingMode::eExclusive,
+            0,                                              // Queue family count
+            nullptr,                                        // Queue family indices
+            vk::ImageLayout::eUndefined
+        );
+
+        // Lazily allocated types only appear in the requirements of transient images,
+        // devices without them fall back to plain device local memory
+        return create_image(create_info, MemoryPreference {
+            vk::MemoryPropertyFlagBits::eDeviceLocal,
+            vk::MemoryPropertyFlagBits::eLazilyAllocated,
+            vk::MemoryPropertyFlagBits::eHostVisible
+        });
+    }
+
+    vk::DeviceSize Manager::get_committed_size(const ImageHandle &handle) {
+        const AllocationRecord &record = resolve(handle);
+        if (memory_properties.memoryTypes[record.type].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated) {
+            return device->get_memory_commitment(record.block->memory);
+        }
+        return record.image.size;
+    }
+
+    inline SlabPoolKey slab_pool_key(const vk::BufferUsageFlags usage_flags, const MemoryPreference &preference) {
+        return SlabPoolKey(
+            (VkBufferUsageFlags)usage_flags,
+            (VkMemoryPropertyFlags)preference.required,
+            (VkMemoryPropertyFlags)preference.preferred,
+            (VkMemoryPropertyFlags)preference.avoided
+        );
+    }
+
+    BufferHandle Manager::create_pooled_buffer(const vk::DeviceSize size, const vk::BufferUsageFlags usage_flags, const MemoryPreference &preference) {
+        SlabPool *pool = nullptr;
+        {
+            // Pools are only ever added, lookups of existing ones share the lock
+            std::shared_lock<std::shared_mutex> lock(sync->pools);
+            auto pool_it = slab_pools.find(slab_pool_key(usage_flags, preference));
+            if (pool_it != slab_pools.end()) {
+                pool = &pool_it->second;
+            }
+        }
+        if (pool == nullptr) {
+            std::unique_lock<std::shared_mutex> lock(sync->pools);
+            auto pool_it = slab_pools.find(slab_pool_key(usage_flags, preference));
+            if (pool_it == slab_pools.end()) {
+                SlabPool new_pool;
+                new_pool.usage = usage_flags;
+                new_pool.preference = preference;
+                new_pool.alignment = 4;
+                if (usage_flags & vk::BufferUsageFlagBits::eUniformBuffer) {
+                    new_pool.alignment = std::max(new_pool.alignment, limits.minUniformBufferOffsetAlignment);
+                }
+                if (usage_flags & vk::BufferUsageFlagBits::eStorageBuffer) {
+                    new_pool.alignment = std::max(new_pool.alignment, limits.minStorageBufferOffsetAlignment);
                 }
-                std::cout << "Allocating memory of type <" << memory_type_to_string(memory_type) << "> and size " << MEMORY_BLOCK_SIZE / 1048576.0f << "MB" << std::endl;
-            }
-
-            vk::DeviceSize last_buffer_end = 0;
-
-            for(auto &[key, val] : mem_block->buffers) {
-                
-                vk::DeviceSize next_buffer_start = integer_step(val.offset, MEMORY_SUBBLOCK_SIZE);
-                if (integer_step(next_buffer_start - last_buffer_end, MEMORY_SUBBLOCK_SIZE) >= mem_reqs.size) {
-                    BufferContainer container;
-                    container.internal_buffer = buffer;
-                    container.offset = last_buffer_end;
-                    container.size = mem_reqs.size;
-                    mem_block->buffers[last_buffer_end] = container;
-                    p_device->bindBufferMemory(mem_block->buffers[last_buffer_end].internal_buffer, mem_block->memory, last_buffer_end);
-
-                    BufferHandle handle;
-                    handle.type = memory_type;
-                    handle.offset = last_buffer_end + mem_block_index * MEMORY_BLOCK_SIZE;
-                    std::cout << "Bound " << handle << std::endl;
-                    return handle;
+                if (usage_flags & (vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst)) {
+                    new_pool.alignment = std::max(new_pool.alignment, limits.optimalBufferCopyOffsetAlignment);
                 }
-                last_buffer_end = integer_step(next_buffer_start + val.size, MEMORY_SUBBLOCK_SIZE);
+                for (auto &cache : new_pool.caches) {
+                    cache = std::make_unique<thread_cache::Cache<SlabSlot>>(SLAB_CACHE_BATCH);
+                }
+                pool_it = slab_pools.emplace(slab_pool_key(usage_flags, preference), std::move(new_pool)).first;
             }
+            pool = &pool_it->second;
+        }
 
-            if (integer_step(mem_reqs.size + last_buffer_end, MEMORY_SUBBLOCK_SIZE) < MEMORY_BLOCK_SIZE) {
-                BufferContainer container;
-                container.internal_buffer = buffer;
-                container.offset = last_buffer_end + mem_block_index * MEMORY_BLOCK_SIZE;
-                container.size = mem_reqs.size;
-                mem_block->buffers[container.offset] = container;
-                p_device->bindBufferMemory(mem_block->buffers[container.offset].internal_buffer, mem_block->memory, last_buffer_end);
+        // Alignments are powers of two, so every slot in a slab stays aligned
+        vk::DeviceSize slot_size = std::max(SLAB_MIN_CLASS_SIZE, pool->alignment);
+        while (slot_size < size) {
+            slot_size *= 2;
+        }
+
+        if (slot_size > SLAB_MAX_CLASS_SIZE) {
+            return create_buffer(size, usage_flags, preference);
+        }
 
-                BufferHandle handle;
-                handle.type = memory_type;
-                handle.offset = last_buffer_end;
-                std::cout << "Bound " << handle << std::endl;
-                return handle;
+        uint32_t size_class = tlsf::detail::highest_bit(slot_size / SLAB_MIN_CLASS_SIZE);
+        thread_cache::Cache<SlabSlot> *cache = pool->caches[size_class].get();
+
+        // Runs under the cache lock once the shared slots of this size class have run out
+        auto add_slab = [&](std::vector<SlabSlot> &slots) {
+            auto slab = std::make_unique<Slab>();
+            slab->buffer = create_block_buffer(SLAB_BUFFER_SIZE, usage_flags, preference, true);
+            slab->slot_size = slot_size;
+            slab->cache = cache;
+            uint32_t slot_count = (uint32_t)(SLAB_BUFFER_SIZE / slot_size);
+            for (uint32_t i = slot_count; i > 0; --i) {
+                slots.push_back(SlabSlot {slab.get(), i - 1});
             }
+            pool->slabs[size_class].push_back(std::move(slab));
+        };
+
+        SlabSlot slab_slot;
+        if (!cache->acquire(slab_slot, add_slab)) {
+            throw std::runtime_error("Unable to allocate slab slot");
+        }
+
+        const AllocationRecord &backing = resolve(slab_slot.slab->buffer);
+        vk::DeviceSize buffer_offset = slab_slot.slot * slot_size;
+
+        uint32_t index = new_record(backing.block, backing.type, backing.buffer.offset + buffer_offset);
+        AllocationRecord &record = record_at(index);
+        record.buffer.internal_buffer = backing.buffer.internal_buffer;
+        record.buffer.offset = backing.buffer.offset + buffer_offset;
+        record.buffer.buffer_offset = buffer_offset;
+        record.buffer.size = size;
+        record.buffer.allocation = tlsf::NULL_NODE;
+        record.slab = slab_slot.slab;
+        record.slot = slab_slot.slot;
+        publish_record(index);
+
+        std::shared_ptr<alloc_trace::Writer> writer = active_trace();
+        if (writer) {
+            alloc_trace::Event event = {};
+            event.op = (uint8_t)alloc_trace::Op::CreateSlot;
+            event.usage = (VkBufferUsageFlags)usage_flags;
+            event.pool = size_class;
+            event.size = slot_size;
+            event.alignment = pool->alignment;
+            trace_event(*writer, event, index);
+        }
 
-            if(mem_block->next == nullptr) {
-                mem_block->next = new MemoryBlock();
+        return BufferHandle {index, record.generation};
+    }
+
+    AllocationRecord& Manager::record_at(const uint32_t index) {
+        return (*record_chunks[index / RECORD_CHUNK_SIZE])[index % RECORD_CHUNK_SIZE];
+    }
+
+    uint32_t Manager::new_record(MemoryBlock *block, const uint32_t type, const vk::DeviceSize offset) {
+        uint32_t index;
+        // The refill runs under the cache lock and hands out a whole new chunk
+        record_cache->acquire(index, [this](std::vector<uint32_t> &shared) {
+            uint32_t first = sync->record_count.load(std::memory_order_relaxed);
+            if (first / RECORD_CHUNK_SIZE >= MAX_RECORD_CHUNKS) {
+                throw std::runtime_error("Allocation table full");
+            }
+            record_chunks[first / RECORD_CHUNK_SIZE] = std::make_unique<RecordChunk>();
+            for (uint32_t i = RECORD_CHUNK_SIZE; i > 0; i--) {
+                shared.push_back(first + i - 1);
             }
+            // Chunks never move, records can be resolved without taking the lock
+            sync->record_count.store(first + RECORD_CHUNK_SIZE, std::memory_order_release);
+        });
+
+        AllocationRecord &record = record_at(index);
+        // Generation 0 is reserved for null handles
+        if (++record.generation == 0) {
+            record.generation = 1;
+        }
+        record.buffer = BufferContainer {};
+        record.image = ImageContainer {};
+        record.block = block;
+        record.slab = nullptr;
+        record.slot = 0;
+        record.mapped = block->mapped ? static_cast<char*>(block->mapped) + offset : nullptr;
+        record.type = type;
+        record.usage = vk::BufferUsageFlags();
+        record.is_image = false;
+        record.retired = false;
+        record.pinned = false;
+        record.move_source = false;
+        record.transfers.store(0, std::memory_order_relaxed);
+
+        return index;
+    }
+
+    // Creation runs without the move lock, a record only becomes visible to defragmentation once it is complete
+    void Manager::publish_record(const uint32_t index) {
+        record_at(index).alive.store(true, std::memory_order_release);
+    }
 
-            mem_block = mem_block->next;
-            ++mem_block_index;
+    void Manager::release_record(const uint32_t index) {
+        AllocationRecord &record = record_at(index);
+        record.alive.store(false, std::memory_order_relaxed);
+        record.block = nullptr;
+        record_cache->release(index);
+    }
+
+    AllocationRecord& Manager::resolve(const uint32_t index, const uint32_t generation) {
+        if (generation == 0) {
+            throw std::runtime_error("Null handle provided");
+        }
+
+        if (index >= sync->record_count.load(std::memory_order_acquire)) {
+            throw std::runtime_error("Invalid handle");
+        }
+
+        AllocationRecord &record = record_at(index);
+        if (!record.alive.load(std::memory_order_acquire) || record.retired || record.generation != generation) {
+            throw std::runtime_error("Stale handle");
         }
 
-        throw std::runtime_error("Unable to allocate buffer");
+        return record;
     }
 
-    void Manager::free(const BufferHandle &handle) {
-        auto *mem_block = &memory_blocks[handle.type];
+    AllocationRecord& Manager::resolve(const BufferHandle &handle) {
+        AllocationRecord &record = resolve(handle.index, handle.generation);
+        if (record.is_image) {
+            throw std::runtime_error("Image handle used as buffer");
+        }
+        return record;
+    }
+
+    AllocationRecord& Manager::resolve(const ImageHandle &handle) {
+        AllocationRecord &record = resolve(handle.index, handle.generation);
+        if (!record.is_image) {
+            throw std::runtime_error("Buffer handle used as image");
+        }
+        return record;
+    }
+
+    void Manager::retire_record(const uint32_t index) {
+        AllocationRecord &record = record_at(index);
+        record.retired = true;
+        record.retired_frame = sync->current_frame.load(std::memory_order_acquire);
+
+        // The render thread only ever takes the whole list, so a plain compare and swap push is safe
+        record.next_retired = sync->retired.load(std::memory_order_relaxed);
+        while (!sync->retired.compare_exchange_weak(record.next_retired, index, std::memory_order_release, std::memory_order_relaxed)) {}
+    }
+
+    // A free racing with begin_frame may be tagged with the previous frame and end up behind
+    // records of the new one, it is then destroyed a frame late, never early
+    void Manager::collect_retired() {
+        size_t first = deferred_frees.size();
+        for (uint32_t index = sync->retired.exchange(NO_RECORD, std::memory_order_acquire); index != NO_RECORD;) {
+            const AllocationRecord &record = record_at(index);
+            deferred_frees.push_back(DeferredFree {record.retired_frame, index});
+            index = record.next_retired;
+        }
+        // The list is newest first
+        std::reverse(deferred_frees.begin() + first, deferred_frees.end());
+    }
+
+    void Manager::destroy_record(const uint32_t index) {
+        AllocationRecord &record = record_at(index);
 
-        for (size_t i = 0; i < handle.offset / MEMORY_BLOCK_SIZE; ) {
-            mem_block = mem_block->next;
+        std::shared_ptr<alloc_trace::Writer> writer = active_trace();
+        if (writer) {
+            alloc_trace::Event event = {};
+            event.op = (uint8_t)alloc_trace::Op::Free;
+            event.flags = record.move_source ? alloc_trace::FLAG_MOVED : 0;
+            trace_event(*writer, event, index);
         }
 
-        auto it = mem_block->buffers.find(handle.offset);
-        if (it != mem_block->buffers.end()) {
-            p_device->destroyBuffer(it->second.internal_buffer);
-            mem_block->buffers.erase (it);
-            std::cout << "Freed " << handle << std::endl;
+        if (record.slab != nullptr) {
+            record.slab->cache->release(SlabSlot {record.slab, record.slot});
+            release_record(index);
             return;
         }
 
-        std::cerr << "Unable to locate buffer" << std::endl;
-        throw std::runtime_error("Unable to locate buffer");
+        if (record.is_image) {
+            device->destroy_image(record.image.internal_image);
+        } else {
+            device->destroy_buffer(record.buffer.internal_buffer);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(sync->blocks);
+            record.block->allocator.free(record.is_image ? record.image.allocation : record.buffer.allocation);
+            defragment_pending = true;
+
+            // Dedicated blocks hold a single resource and are returned right away
+            if (record.block->dedicated && record.block->allocator.empty()) {
+                release_dedicated(record.block);
+            }
+        }
+        release_record(index);
+    }
+
+    void Manager::free(const BufferHandle &handle) {
+        resolve(handle);
+        retire_record(handle.index);
+    }
+
+    void Manager::free_immediate(const BufferHandle &handle) {
+        resolve(handle);
+        destroy_record(handle.index);
+    }
+
+    void Manager::free_image(const ImageHandle &handle) {
+        resolve(handle);
+        retire_record(handle.index);
+    }
+
+    void Manager::begin_frame(const uint64_t frame, const uint64_t completed_frames) {
+        sync->current_frame.store(frame, std::memory_order_release);
+        std::shared_ptr<alloc_trace::Writer> writer = active_trace();
+        if (writer) {
+            alloc_trace::Event event = {};
+            event.op = (uint8_t)alloc_trace::Op::Frame;
+            event.size = completed_frames;
+            event.frame = frame;
+            writer->write(event);
+        }
+
+        collect_retired();
+        while (!deferred_frees.empty() && deferred_frees.front().frame < completed_frames) {
+            uint32_t index = deferred_frees.front().index;
+            deferred_frees.pop_front();
+            destroy_record(index);
+        }
+    }
+
+    void Manager::flush_frees() {
+        collect_retired();
+        std::deque<DeferredFree> pending;
+        pending.swap(deferred_frees);
+
+        for (auto &deferred : pending) {
+            destroy_record(deferred.index);
+        }
     }
 
     BufferContainer Manager::get_buffer(const BufferHandle &handle) {
+        std::shared_lock<std::shared_mutex> lock(sync->moves);
+        return resolve(handle).buffer;
+    }
 
-        if (handle.type == 0) {
-            throw std::runtime_error("Null handle provided");
+    void Manager::hold_for_transfer(const BufferHandle &handle) {
+        resolve(handle).transfers.fetch_add(1, std::memory_order_release);
+    }
+
+    // The batch may complete after the buffer was freed and its record reused
+    void Manager::release_from_transfer(const BufferHandle &handle) {
+        if (handle.index >= sync->record_count.load(std::memory_order_acquire)) {
+            return;
+        }
+        AllocationRecord &record = record_at(handle.index);
+        if (record.generation == handle.generation) {
+            record.transfers.fetch_sub(1, std::memory_order_release);
         }
+    }
 
-        auto *mem_block = &memory_blocks[handle.type];
+    ImageContainer Manager::get_image(const ImageHandle &handle) {
+        return resolve(handle).image;
+    }
 
-        for (size_t i = 0; i < handle.offset / MEMORY_BLOCK_SIZE; ) {
-            mem_block = mem_block->next;
+    void Manager::release_block(MemoryBlock &block) {
+        if (block.mapped != nullptr) {
+            device->unmap_memory(block.memory);
         }
+        device->free_memory(block.memory);
+    }
+
+    bool Manager::move_buffer(vk::CommandBuffer &command_buffer, const uint32_t index, std::vector<std::unique_ptr<MemoryBlock>> &blocks) {
+        const BufferContainer old_buffer = record_at(index).buffer;
+        MemoryBlock *source = record_at(index).block;
 
-        auto it = mem_block->buffers.find(handle.offset % MEMORY_BLOCK_SIZE);
-        if (it != mem_block->buffers.end()) {
-            return it->second;
+        vk::BufferCreateInfo create_info(
+            vk::BufferCreateFlags(),
+            old_buffer.size,
+            record_at(index).usage,
+            vk::SharingMode::eExclusive
+        );
+
+        vk::Buffer buffer = device->create_buffer(create_info);
+
+        vk::MemoryDedicatedRequirements dedicated_reqs;
+        vk::MemoryRequirements mem_reqs = device->get_buffer_memory_requirements(buffer, dedicated_reqs);
+
+        tlsf::Allocation allocation;
+        MemoryBlock *destination = nullptr;
+        for (auto &block : blocks) {
+            if (block.get() != source && !block->dedicated && block->allocator.allocate(mem_reqs.size, mem_reqs.alignment, allocation)) {
+                destination = block.get();
+                break;
+            }
         }
 
-        throw std::runtime_error("Unable to locate buffer");
+        if (destination == nullptr) {
+            device->destroy_buffer(buffer);
+            return false;
+        }
+
+        device->bind_buffer_memory(buffer, destination->memory, allocation.offset);
+        track_peak(destination->memory_type);
+
+        vk::BufferCopy copy_region(0, 0, old_buffer.size);
+        device->copy_buffer(command_buffer, old_buffer.internal_buffer, buffer, copy_region);
+
+        // The old buffer may still be read by frames in flight, it is kept alive by a
+        // retired record until the current frame has completed
+        uint32_t old_index = new_record(source, record_at(index).type, old_buffer.offset);
+        record_at(old_index).buffer = old_buffer;
+        record_at(old_index).move_source = true;
+        publish_record(old_index);
+        retire_record(old_index);
+
+        AllocationRecord &record = record_at(index);
+        record.block = destination;
+        record.mapped = nullptr;
+        record.buffer.internal_buffer = buffer;
+        record.buffer.offset = allocation.offset;
+        record.buffer.allocation = allocation.node;
+
+        std::shared_ptr<alloc_trace::Writer> writer = active_trace();
+        if (writer) {
+            alloc_trace::Event event = {};
+            event.op = (uint8_t)alloc_trace::Op::Move;
+            event.usage = (VkBufferUsageFlags)record.usage;
+            event.pool = block_pool(destination->memory_type, false);
+            event.size = old_buffer.size;
+            event.alignment = mem_reqs.alignment;
+            trace_event(*writer, event, index);
+        }
+        return true;
     }
 
-    vk::DeviceMemory Manager::get_memory(const BufferHandle &handle) {
-        auto *mem_block = &memory_blocks[handle.type];
+    DefragmentationStats Manager::defragment(vk::CommandBuffer &command_buffer, const vk::DeviceSize byte_budget) {
+        DefragmentationStats stats;
+
+        // Checked without the move lock, frames where no block became sparser don't stall other threads
+        {
+            std::lock_guard<std::mutex> lock(sync->blocks);
+            if (!defragment_pending) {
+                return stats;
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> move_lock(sync->moves);
+        std::lock_guard<std::mutex> lock(sync->blocks);
+        defragment_pending = false;
+
+        // Blocks evacuated by earlier passes are empty once their old buffers have been destroyed,
+        // one block per memory type is kept to avoid reallocating it right away
+        for (auto &[pool, blocks] : memory_blocks) {
+            for (auto it = blocks.begin(); it != blocks.end() && blocks.size() > 1;) {
+                if ((*it)->allocator.empty() && !(*it)->dedicated) {
+                    stats.bytes_reclaimed += (*it)->size;
+                    release_block(**it);
+                    it = blocks.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        // Live records by block, a block holding anything that can't be moved is never a source
+        std::unordered_map<MemoryBlock*, std::vector<uint32_t>> movable;
+        std::unordered_set<MemoryBlock*> pinned_blocks;
+        uint32_t record_count = sync->record_count.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < record_count; i++) {
+            const AllocationRecord &record = record_at(i);
+            if (!record.alive.load(std::memory_order_acquire) || record.retired || record.block == nullptr) {
+                continue;
+            }
+            if (record.is_image || record.pinned || record.slab != nullptr || record.transfers.load(std::memory_order_acquire) > 0) {
+                pinned_blocks.insert(record.block);
+            } else {
+                movable[record.block].push_back(i);
+            }
+        }
+
+        bool barrier_recorded = false;
+
+        for (auto &[pool, blocks] : memory_blocks) {
+            if (blocks.size() < 2) {
+                continue;
+            }
 
-        for (size_t i = 0; i < handle.offset / MEMORY_BLOCK_SIZE; ) {
-            mem_block = mem_block->next;
+            // Host visible blocks hand out persistent pointers that would dangle
+            MemoryBlock *source = nullptr;
+            for (auto &block : blocks) {
+                if (block->allocator.empty() || block->dedicated || block->mapped != nullptr || pinned_blocks.count(block.get()) > 0) {
+                    continue;
+                }
+                if (source == nullptr || block->allocator.get_used() < source->allocator.get_used()) {
+                    source = block.get();
+                }
+            }
+
+            if (source == nullptr) {
+                continue;
+            }
+
+            for (uint32_t index : movable[source]) {
+                vk::DeviceSize size = record_at(index).buffer.size;
+                if (stats.bytes_moved + size > byte_budget) {
+                    // Continued next frame
+                    defragment_pending = true;
+                    break;
+                }
+
+                if (!barrier_recorded) {
+                    // Make earlier uploads to the buffers being moved visible to the copies
+                    vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead);
+                    device->memory_barrier(
+                        command_buffer,
+                        vk::PipelineStageFlagBits::eTransfer,
+                        vk::PipelineStageFlagBits::eTransfer,
+                        barrier
+                    );
+                    barrier_recorded = true;
+                }
+
+                if (!move_buffer(command_buffer, index, blocks)) {
+                    break;
+                }
+                stats.bytes_moved += size;
+                ++stats.allocations_moved;
+            }
         }
 
-        return mem_block->memory;
+        if (stats.allocations_moved > 0) {
+            vk::MemoryBarrier barrier(
+                vk::AccessFlagBits::eTransferWrite,
+                vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead
+            );
+            device->memory_barrier(
+                command_buffer,
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader,
+                barrier
+            );
+        }
+
+        if (stats.allocations_moved > 0 || stats.bytes_reclaimed > 0) {
+            std::cout << "Defragmentation moved " << stats.allocations_moved << " buffers (" << stats.bytes_moved
+                << " bytes), released " << stats.bytes_reclaimed / 1048576.0f << "MB" << std::endl;
+        }
+
+        return stats;
     }
 
-    Manager::Manager(vk::PhysicalDevice *p_physical_device, vk::Device *p_device, vk::Queue *p_queue, vk::CommandPool *p_command_pool)
-        : p_physical_device(p_physical_device), p_device(p_device), p_queue(p_queue), p_command_pool(p_command_pool) {}
+    vk::DeviceMemory Manager::get_memory(const BufferHandle &handle) {
+        std::shared_lock<std::shared_mutex> lock(sync->moves);
+        return resolve(handle).block->memory;
+    }
+
+    Manager::Manager(std::unique_ptr<Device> device)
+        : device(std::move(device)) {
+        sync = std::make_unique<Sync>();
+        record_cache = std::make_unique<thread_cache::Cache<uint32_t>>(RECORD_CACHE_BATCH);
+        limits = this->device->get_properties().limits;
+        memory_properties = this->device->get_memory_properties();
+
+        // Blocks start small and stop growing at an eighth of the heap, so small heaps still fit several
+        for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+            vk::DeviceSize heap_size = memory_properties.memoryHeaps[i].size;
+            BlockSizeConfig config;
+            config.max_block_size = std::max(MIN_MEMORY_BLOCK_SIZE, std::min(MEMORY_BLOCK_SIZE, integer_step(heap_size / 8, MIN_MEMORY_BLOCK_SIZE)));
+            config.initial_block_size = std::max(MIN_MEMORY_BLOCK_SIZE, config.max_block_size / 16);
+            config.dedicated_threshold = config.max_block_size / 2;
+            block_sizes.push_back(config);
+        }
+    }
 
+    // Staging stays out of device local memory, host visible device memory is often a small window
     BufferHandle Manager::create_transfer_buffer(const vk::DeviceSize size) {
-        return create_buffer(
+        return create_pooled_buffer(
             size,
             vk::BufferUsageFlagBits::eTransferSrc,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+            MemoryPreference {
+                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,   // Required
+                vk::MemoryPropertyFlags(),                                                              // Preferred
+                vk::MemoryPropertyFlagBits::eDeviceLocal                                                // Avoided
+            }
         );
     }
 
+    // Static buffers avoid host visible memory, on unified memory they end up in it anyway and are written directly
     BufferHandle Manager::create_vertex_buffer(const vk::DeviceSize size) {
         return create_buffer(
             size,
-            vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
-            vk::MemoryPropertyFlagBits::eDeviceLocal
+            vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
+            MemoryPreference {
+                vk::MemoryPropertyFlagBits::eDeviceLocal,   // Required
+                vk::MemoryPropertyFlags(),                  // Preferred
+                vk::MemoryPropertyFlagBits::eHostVisible    // Avoided
+            }
         );
     }
 
     BufferHandle Manager::create_index_buffer(const vk::DeviceSize size) {
         return create_buffer(
             size,
-            vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
-            vk::MemoryPropertyFlagBits::eDeviceLocal
+            vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
+            MemoryPreference {
+                vk::MemoryPropertyFlagBits::eDeviceLocal,   // Required
+                vk::MemoryPropertyFlags(),                  // Preferred
+                vk::MemoryPropertyFlagBits::eHostVisible    // Avoided
+            }
         );
     }
 
     BufferHandle Manager::create_uniform_buffer(const vk::DeviceSize size) {
-        return create_buffer(
+        return create_pooled_buffer(
             size,
             vk::BufferUsageFlagBits::eUniformBuffer,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+            MemoryPreference {
+                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,   // Required
+                vk::MemoryPropertyFlagBits::eDeviceLocal                                                // Preferred
+            }
         );
     }
 
-    vk::CommandBuffer Manager::begin_one_time_command() {
-        vk::CommandBufferAllocateInfo alloc_info(
-            *p_command_pool,
-            vk::CommandBufferLevel::ePrimary,
-            1
+    // CPU reads from uncached memory are very slow, readback prefers cached memory over coherent memory
+    BufferHandle Manager::create_readback_buffer(const vk::DeviceSize size) {
+        return create_buffer(
+            size,
+            vk::BufferUsageFlagBits::eTransferDst,
+            MemoryPreference {
+                vk::MemoryPropertyFlagBits::eHostVisible,   // Required
+                vk::MemoryPropertyFlagBits::eHostCached,    // Preferred
+                vk::MemoryPropertyFlagBits::eDeviceLocal    // Avoided
+            }
         );
+    }
 
-        vk::CommandBuffer command_buffer = p_device->allocateCommandBuffers(alloc_info)[0];
+    bool Manager::is_host_visible(const BufferHandle &handle) {
+        return resolve(handle).mapped != nullptr;
+    }
 
-        vk::CommandBufferBeginInfo begin_info(
-            vk::CommandBufferUsageFlagBits::eOneTimeSubmit
-        );
+    void* Manager::mapMemory(const BufferHandle &handle) {
+        void *data = resolve(handle).mapped;
+        if (data == nullptr) {
+            throw std::runtime_error("Buffer is not host visible");
+        }
+        std::shared_ptr<alloc_trace::Writer> writer = active_trace();
+        if (writer) {
+            alloc_trace::Event event = {};
+            event.op = (uint8_t)alloc_trace::Op::Map;
+            trace_event(*writer, event, handle.index);
+        }
+        return data;
+    }
+
+    void Manager::unmapMemory(const BufferHandle &handle) {
+        // Blocks stay mapped until they are freed, only non-coherent writes need to be flushed
+        flush(handle);
+        std::shared_ptr<alloc_trace::Writer> writer = active_trace();
+        if (writer) {
+            alloc_trace::Event event = {};
+            event.op = (uint8_t)alloc_trace::Op::Unmap;
+            trace_event(*writer, event, handle.index);
+        }
+    }
 
-        command_buffer.begin(begin_info);
+    void Manager::start_trace(const std::string &filename) {
+        alloc_trace::Header header;
+        for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+            header.memory_types.push_back(alloc_trace::MemoryType {
+                (VkMemoryPropertyFlags)memory_properties.memoryTypes[i].propertyFlags,
+                memory_properties.memoryTypes[i].heapIndex
+            });
+        }
+        for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+            header.heap_sizes.push_back(memory_properties.memoryHeaps[i].size);
+        }
 
-        return command_buffer;
+        std::atomic_store(&trace, std::make_shared<alloc_trace::Writer>(filename, header));
+        sync->tracing.store(true, std::memory_order_release);
+        std::cout << "Tracing allocations to " << filename << std::endl;
     }
 
-    void Manager::end_one_time_command(vk::CommandBuffer &command_buffer) {
-        command_buffer.end();
+    void Manager::stop_trace() {
+        sync->tracing.store(false, std::memory_order_release);
+        std::shared_ptr<alloc_trace::Writer> writer = std::atomic_exchange(&trace, std::shared_ptr<alloc_trace::Writer>());
+        if (writer) {
+            std::cout << "Allocation trace finished with " << writer->get_event_count() << " events" << std::endl;
+        }
+    }
 
-        vk::SubmitInfo submit_info(0, nullptr, nullptr, 1, &command_buffer, 0, nullptr);
+    bool Manager::is_tracing() const {
+        return sync->tracing.load(std::memory_order_acquire);
+    }
 
-        p_queue->submit(submit_info, nullptr);
-        p_queue->waitIdle();
-        p_device->freeCommandBuffers(*p_command_pool, command_buffer);
+    // Allocating threads hold their own reference, the trace is closed once the last of them is done with it
+    std::shared_ptr<alloc_trace::Writer> Manager::active_trace() const {
+        if (!sync->tracing.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return std::atomic_load(&trace);
     }
 
-    void Manager::copy_buffer(BufferHandle &src_handle, BufferHandle &dst_handle) {
-        BufferContainer src = get_buffer(src_handle);
-        BufferContainer dst = get_buffer(dst_handle);
+    // Fills in the fields shared by all events on a record
+    void Manager::trace_event(alloc_trace::Writer &writer, alloc_trace::Event &event, const uint32_t index) {
+        const AllocationRecord &record = record_at(index);
+        event.memory_type = (uint8_t)record.type;
+        event.property_flags = (VkMemoryPropertyFlags)memory_properties.memoryTypes[record.type].propertyFlags;
+        event.index = index;
+        event.generation = record.generation;
+        event.frame = sync->current_frame.load(std::memory_order_relaxed);
+        writer.write(event);
+    }
 
-        if (dst.size < src.size) {
-            throw std::runtime_error("Error: Attempting to copy to a undersized buffer");
+    vk::MappedMemoryRange Manager::atom_range(const AllocationRecord &record, const vk::DeviceSize offset, const vk::DeviceSize size) {
+        if (offset > record.buffer.size) {
+            throw std::runtime_error("Range outside of buffer");
         }
 
-        std::cout << "Copying from " << src_handle << " to " << dst_handle << std::endl;
+        vk::DeviceSize atom = limits.nonCoherentAtomSize;
+        vk::DeviceSize start = record.buffer.offset + offset;
+        vk::DeviceSize end = start + std::min(size, record.buffer.size - offset);
 
-        auto command_buffer = begin_one_time_command();
-        
-        vk::BufferCopy copy_region(
-            0,           // Source offset
-            0,           // Destination offset
-            src.size   // Size
-        );
-        
-        command_buffer.copyBuffer(src, dst, copy_region);
+        // Ranges must be multiples of nonCoherentAtomSize or reach the end of the memory
+        start = (start / atom) * atom;
+        end = std::min(integer_step(end, atom), record.block->size);
 
-        end_one_time_command(command_buffer);
-        
+        return vk::MappedMemoryRange(record.block->memory, start, end - start);
     }
 
-    struct layout_transition_flags {
-        vk::AccessFlags src_mask;
-        vk::AccessFlags dst_mask;
-        vk::PipelineStageFlags src_stage;
-        vk::PipelineStageFlags dst_stage;
-    };
-
-    constexpr layout_transition_flags get_layout_transition_flags(const vk::ImageLayout &old_layout, const vk::ImageLayout &new_layout) {
-        if (old_layout == vk::ImageLayout::eUndefined && new_layout == vk::ImageLayout::eTransferDstOptimal) {
-            return layout_transition_flags {
-                vk::AccessFlags(),
-                vk::AccessFlagBits::eTransferWrite,
-                vk::PipelineStageFlagBits::eTopOfPipe,
-                vk::PipelineStageFlagBits::eTransfer
-            };
-        } else if (old_layout == vk::ImageLayout::eTransferDstOptimal && new_layout == vk::ImageLayout::eShaderReadOnlyOptimal) {
-            return layout_transition_flags {
-                vk::AccessFlagBits::eTransferWrite,
-                vk::AccessFlagBits::eShaderRead,
-                vk::PipelineStageFlagBits::eTransfer,
-                vk::PipelineStageFlagBits::eFragmentShader
-            };
-        } else {
-            throw std::invalid_argument("Unsupported layout transition");
+    void Manager::flush(const BufferHandle &handle, const vk::DeviceSize offset, const vk::DeviceSize size) {
+        const AllocationRecord &record = resolve(handle);
+        if (record.mapped == nullptr) {
+            throw std::runtime_error("Buffer is not host visible");
+        }
+        if (!(memory_properties.memoryTypes[record.type].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+            device->flush_memory(atom_range(record, offset, size));
         }
     }
 
-    void Manager::layout_transition(vk::Image image, const vk::Format &format, const vk::ImageLayout &old_layout, const vk::ImageLayout &new_layout) {
-
-        (void)format;
+    void Manager::invalidate(const BufferHandle &handle, const vk::DeviceSize offset, const vk::DeviceSize size) {
+        const AllocationRecord &record = resolve(handle);
+        if (record.mapped == nullptr) {
+            throw std::runtime_error("Buffer is not host visible");
+        }
+        if (!(memory_properties.memoryTypes[record.type].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+            device->invalidate_memory(atom_range(record, offset, size));
+        }
+    }
 
-        auto layout_transition = get_layout_transition_flags(old_layout, new_layout);
+    void Manager::destroy() {
+        if (!sync) {
+            return;
+        }
+        stop_trace();
 
-        std::cout << "Layout transition" <<  (uint32_t)layout_transition.src_mask <<  "," << (uint32_t)layout_transition.dst_mask << "," << (uint32_t)layout_transition.src_stage << "," << (uint32_t)layout_transition.dst_stage << std::endl;
+        uint32_t record_count = sync->record_count.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < record_count; i++) {
+            AllocationRecord &record = record_at(i);
+            if (!record.alive) {
+                continue;
+            }
+            if (record.is_image) {
+                device->destroy_image(record.image.internal_image);
+            } else if (record.slab == nullptr) {
+                device->destroy_buffer(record.buffer.internal_buffer);
+            }
+        }
+        for (auto &chunk : record_chunks) {
+            chunk.reset();
+        }
+        sync->record_count = 0;
+        sync->retired = NO_RECORD;
+        // Indices left in the thread caches of the old one are dropped with it
+        record_cache = std::make_unique<thread_cache::Cache<uint32_t>>(RECORD_CACHE_BATCH);
+        slab_pools.clear();
+        deferred_frees.clear();
+
+        for (auto &[type, blocks] : memory_blocks) {
+            for (auto &block : blocks) {
+                release_block(*block);
+            }
+        }
+        memory_blocks.clear();
+    }
+    
+    float MemoryStats::fragmentation() const {
+        vk::DeviceSize free = reserved - used;
+        if (free == 0) {
+            return 0.0f;
+        }
+        return 1.0f - (float)largest_free / (float)free;
+    }
 
-        auto command_buffer = begin_one_time_command();
+    Statistics Manager::get_statistics() {
+        Statistics stats;
+        stats.types.resize(memory_properties.memoryTypeCount);
+        stats.heaps.resize(memory_properties.memoryHeapCount);
+
+        std::unique_lock<std::mutex> lock(sync->blocks);
+        for (auto &[pool, blocks] : memory_blocks) {
+            for (auto &block : blocks) {
+                MemoryStats &type_stats = stats.types[block->memory_type];
+                type_stats.block_count++;
+                type_stats.reserved += block->size;
+                type_stats.committed += (memory_properties.memoryTypes[block->memory_type].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated)
+                    ? device->get_memory_commitment(block->memory) : block->size;
+                type_stats.used += block->allocator.get_used();
+                type_stats.allocation_count += block->allocator.get_allocation_count();
+                type_stats.largest_free = std::max(type_stats.largest_free, block->allocator.get_largest_free());
+            }
+        }
 
-        vk::ImageMemoryBarrier barrier(
-            layout_transition.src_mask, // Src access mask
-            layout_transition.dst_mask, // Dst access mask
-            old_layout, // Old layout
-            new_layout, // New layout
-            VK_QUEUE_FAMILY_IGNORED,
-            VK_QUEUE_FAMILY_IGNORED,
-            image,
-            vk::ImageSubresourceRange(
-                vk::ImageAspectFlagBits::eColor,
-                0, // Base mip level
-                1, // Level count
-                0, // Base array layer
-                1  // Layer count
-            )
-        );
+        for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+            MemoryStats &type_stats = stats.types[i];
+            type_stats.peak_used = peak_used[i];
+
+            HeapStats &heap_stats = stats.heaps[memory_properties.memoryTypes[i].heapIndex];
+            heap_stats.block_count += type_stats.block_count;
+            heap_stats.reserved += type_stats.reserved;
+            heap_stats.committed += type_stats.committed;
+            heap_stats.used += type_stats.used;
+            heap_stats.allocation_count += type_stats.allocation_count;
+            heap_stats.largest_free = std::max(heap_stats.largest_free, type_stats.largest_free);
+        }
+        for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+            stats.heaps[i].peak_used = heap_peak_used[i];
+        }
+        lock.unlock();
+
+        // Without VK_EXT_memory_budget only our own blocks are known, the budget is estimated
+        // as 80% of the heap to leave room for other processes
+        for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+            stats.heaps[i].size = memory_properties.memoryHeaps[i].size;
+            stats.heaps[i].budget = memory_properties.memoryHeaps[i].size * 8 / 10;
+            stats.heaps[i].usage = stats.heaps[i].reserved;
+        }
 
-        command_buffer.pipelineBarrier(
-            layout_transition.src_stage,   // Src stage
-            layout_transition.dst_stage,   // Dst stage
-            vk::DependencyFlags(),      // Dependency flags
-            nullptr,                    // Memory barrier
-            nullptr,                    // Buffer barrier
-            barrier                     // Image barrier
-        );
+        vk::DeviceSize budget[VK_MAX_MEMORY_HEAPS], usage[VK_MAX_MEMORY_HEAPS];
+        stats.memory_budget = device->get_memory_budget(budget, usage);
+        if (stats.memory_budget) {
+            for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+                stats.heaps[i].budget = budget[i];
+                stats.heaps[i].usage = usage[i];
+            }
+        }
 
-        end_one_time_command(command_buffer);
+        return stats;
     }
 
-    void Manager::copy_buffer(BufferHandle &src_handle, vk::Image &dst_image, uint32_t width, uint32_t height, const vk::Format &format, const vk::ImageLayout &old_layout) {
-        
-
-        layout_transition(dst_image, format, old_layout, vk::ImageLayout::eTransferDstOptimal);
-
-        {// Copy operation
-            auto command_buffer = begin_one_time_command();
-
-            vk::BufferImageCopy copy_region(
-                0,  // Buffer offset
-                0,  // Buffer row length
-                0,  // Buffer image height
-                vk::ImageSubresourceLayers(
-                    vk::ImageAspectFlagBits::eColor,
-                    0,  // Mip level
-                    0,  // Base array layer
-                    1   // Layer count
-                ),
-                vk::Offset3D(),                 // Offset
-                vk::Extent3D(width, height, 1)  // Extent
-            );
+    void write_memory_stats(std::ostream &stream, const MemoryStats &stats) {
+        stream << "\"blocks\": " << stats.block_count
+            << ", \"reserved\": " << stats.reserved
+            << ", \"committed\": " << stats.committed
+            << ", \"used\": " << stats.used
+            << ", \"allocations\": " << stats.allocation_count
+            << ", \"largest_free\": " << stats.largest_free
+            << ", \"fragmentation\": " << stats.fragmentation()
+            << ", \"peak_used\": " << stats.peak_used;
+    }
 
-            command_buffer.copyBufferToImage(get_buffer(src_handle), dst_image, vk::ImageLayout::eTransferDstOptimal, copy_region);
+    void Manager::dump_statistics(std::ostream &stream) {
+        Statistics stats = get_statistics();
+
+        stream << "{\n  \"memory_types\": [";
+        for (uint32_t i = 0; i < stats.types.size(); i++) {
+            stream << (i == 0 ? "\n" : ",\n");
+            stream << "    {\"index\": " << i
+                << ", \"heap\": " << memory_properties.memoryTypes[i].heapIndex
+                << ", \"flags\": \"" << memory_type_to_string(memory_properties.memoryTypes[i].propertyFlags) << "\", ";
+            write_memory_stats(stream, stats.types[i]);
+            stream << "}";
+        }
+        stream << "\n  ],\n  \"heaps\": [";
+        for (uint32_t i = 0; i < stats.heaps.size(); i++) {
+            stream << (i == 0 ? "\n" : ",\n");
+            stream << "    {\"index\": " << i
+                << ", \"size\": " << stats.heaps[i].size
+                << ", \"budget\": " << stats.heaps[i].budget
+                << ", \"usage\": " << stats.heaps[i].usage << ", ";
+            write_memory_stats(stream, stats.heaps[i]);
+            stream << "}";
+        }
+        stream << "\n  ],\n  \"memory_budget_ext\": " << (stats.memory_budget ? "true" : "false") << "\n}" << std::endl;
+    }
 
-            end_one_time_command(command_buffer);
+    void Manager::set_block_sizes(const uint32_t heap, const BlockSizeConfig &config) {
+        if (heap >= block_sizes.size()) {
+            throw std::runtime_error("Invalid memory heap");
+        }
+        if (config.initial_block_size > config.max_block_size || config.initial_block_size < MEMORY_SUBBLOCK_SIZE) {
+            throw std::runtime_error("Invalid block sizes");
         }
 
-        layout_transition(dst_image, format, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+        std::lock_guard<std::mutex> lock(sync->blocks);
+        block_sizes[heap] = config;
+    }
 
-        
+    const BlockSizeConfig& Manager::get_block_sizes(const uint32_t heap) const {
+        return block_sizes.at(heap);
     }
 
-    void* Manager::mapMemory(const BufferHandle &handle, const vk::MemoryMapFlags flags) {
-        BufferContainer con = get_buffer(handle);
-        //std::cout << "Mapping " << handle << " to memory" << std::endl;
-        return p_device->mapMemory(get_memory(handle), con.offset, con.size, flags);
+    const vk::PhysicalDeviceLimits& Manager::get_limits() const {
+        return limits;
     }
 
-    void Manager::unmapMemory(const BufferHandle &handle) {
-        //std::cout << "Unmapping memory" << std::endl;
-        p_device->unmapMemory(get_memory(handle));
+    FrameRing::FrameRing(Manager *p_manager, const vk::DeviceSize frame_size, const uint32_t frame_count)
+        : p_manager(p_manager) {
+        alignment = std::max((vk::DeviceSize)16, p_manager->get_limits().minUniformBufferOffsetAlignment);
+        this->frame_size = integer_step(frame_size, alignment);
+        buffer = p_manager->create_uniform_buffer(this->frame_size * frame_count);
+        data = static_cast<char*>(p_manager->mapMemory(buffer));
+        head = 0;
+        end = this->frame_size;
     }
 
-    void destroy_recursive(const vk::Device &device, MemoryBlock &block) {
-        for (auto &[key, val] : block.buffers) {
-            device.destroyBuffer(val.internal_buffer);
-        }
-        device.free(block.memory);
+    void FrameRing::begin_frame(const uint32_t frame) {
+        head = frame * frame_size;
+        end = head + frame_size;
+    }
 
-        if (block.next != nullptr) {
-            destroy_recursive(device, *block.next);
+    RingAllocation FrameRing::allocate(const vk::DeviceSize size) {
+        vk::DeviceSize offset = head;
+        head = integer_step(head + size, alignment);
+        if (head > end) {
+            throw std::runtime_error("Frame ring exhausted");
         }
-
-        delete block.next;
+        return RingAllocation {data + offset, (uint32_t)offset};
     }
 
-    void Manager::destroy() {
-        for (auto &[key, val] : memory_blocks) {
-            destroy_recursive(*p_device, val);
-        }
+    BufferContainer FrameRing::get_buffer() {
+        return p_manager->get_buffer(buffer);
     }
-    
-}
\ No newline at end of file
+
+}
@@ -2,20 +2,52 @@
 #define VULKAN_MEMORY_HPP
 
 #include "includes.hpp"
+#include "vulkan_device.hpp"
+#include "util/tlsf.hpp"
+#include "util/thread_cache.hpp"
+#include "util/alloc_trace.hpp"
 #include <tuple>
 #include <memory>
 #include <map>
 #include <vector>
+#include <array>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <cstring>
 
 namespace vk_mem {
 
+    // Default range for block sizes, clamped further on small heaps
     static const vk::DeviceSize MEMORY_BLOCK_SIZE = 64 * 1024 * 1024;
+    static const vk::DeviceSize MIN_MEMORY_BLOCK_SIZE = 1024 * 1024;
     static const vk::DeviceSize MEMORY_SUBBLOCK_SIZE = 1024;
 
+    // Marks block pools reserved for optimal tiling images
+    static const uint32_t OPTIMAL_IMAGE_POOL = 0x100;
+
+    // Small buffers are packed into shared slab buffers with power-of-two slot sizes
+    static const vk::DeviceSize SLAB_MIN_CLASS_SIZE = 64;
+    static const vk::DeviceSize SLAB_MAX_CLASS_SIZE = 4096;
+    static const uint32_t SLAB_CLASS_COUNT = 7;
+    static const vk::DeviceSize SLAB_BUFFER_SIZE = 256 * 1024;
+    // Slots moved between a thread's cache and the shared slab pool at a time
+    static const size_t SLAB_CACHE_BATCH = 16;
+
+    // Allocation records are stored in fixed chunks so they never move once created
+    static const uint32_t RECORD_CHUNK_SIZE = 1024;
+    static const uint32_t MAX_RECORD_CHUNKS = 4096;
+    // Record indices moved between a thread's cache and the shared free list at a time
+    static const size_t RECORD_CACHE_BATCH = 64;
+    // Ends the list of retired records
+    static const uint32_t NO_RECORD = UINT32_MAX;
+
     struct ImageContainer {
         vk::Image internal_image;
         vk::DeviceSize offset;
         vk::DeviceSize size;
+        uint32_t allocation;
 
         bool operator < (const ImageContainer& str) const;
         operator vk::Image() const;
@@ -23,23 +55,26 @@ namespace vk_mem {
 
     struct BufferContainer {
         vk::Buffer internal_buffer;
-        vk::DeviceSize offset;
+        vk::DeviceSize offset;          // Offset in device memory
+        vk::DeviceSize buffer_offset;   // Offset inside internal_buffer, non-zero for slab allocations
         vk::DeviceSize size;
+        uint32_t allocation;
 
         bool operator < (const BufferContainer& str) const;
         operator vk::Buffer() const;
     };
 
     struct ImageHandle {
-        uint32_t type;
-        vk::DeviceSize offset;
+        uint32_t index = 0;
+        uint32_t generation = 0;
 
         friend std::ostream& operator<< (std::ostream& stream, const ImageHandle& handle);
     };
 
+    // Slot in the allocation table, a handle is stale once its slot has been freed
     struct BufferHandle {
-        uint32_t type;
-        vk::DeviceSize offset;
+        uint32_t index = 0;
+        uint32_t generation = 0;
 
         friend std::ostream& operator<< (std::ostream& stream, const BufferHandle& handle);
     };
@@ -47,46 +82,299 @@ namespace vk_mem {
     struct MemoryBlock {
         vk::DeviceMemory memory;
         vk::DeviceSize size;
-        std::map<vk::DeviceSize, BufferContainer> buffers;
-        MemoryBlock *next;
+        uint32_t memory_type;
+        bool dedicated;     // Holds a single resource, released once it is freed
+        tlsf::Allocator allocator;
+        void *mapped;   // Persistent mapping of the whole block, null if not host visible
+    };
+
+    struct Slab;
+
+    struct SlabSlot {
+        Slab *slab;
+        uint32_t slot;
+    };
+
+    struct Slab {
+        BufferHandle buffer;
+        vk::DeviceSize slot_size;
+        thread_cache::Cache<SlabSlot> *cache;   // Free slots of this size class
+    };
+
+    /**
+     * Memory types must have all required flags, among those the type with the most
+     * preferred and fewest avoided flags is picked.
+     */
+    struct MemoryPreference {
+        vk::MemoryPropertyFlags required;
+        vk::MemoryPropertyFlags preferred;
+        vk::MemoryPropertyFlags avoided;
     };
 
+    // Usage followed by required, preferred and avoided memory flags
+    using SlabPoolKey = std::tuple<VkBufferUsageFlags, VkMemoryPropertyFlags, VkMemoryPropertyFlags, VkMemoryPropertyFlags>;
+
+    struct SlabPool {
+        vk::BufferUsageFlags usage;
+        MemoryPreference preference;
+        vk::DeviceSize alignment;
+        std::array<std::vector<std::unique_ptr<Slab>>, SLAB_CLASS_COUNT> slabs;  // Guarded by the cache of their class
+        std::array<std::unique_ptr<thread_cache::Cache<SlabSlot>>, SLAB_CLASS_COUNT> caches;
+    };
+
+    struct AllocationRecord {
+        BufferContainer buffer;
+        ImageContainer image;
+        MemoryBlock *block;
+        Slab *slab;
+        uint32_t slot;
+        void *mapped;
+        uint32_t type;
+        uint32_t generation;
+        vk::BufferUsageFlags usage;
+        bool is_image;
+        std::atomic<bool> alive;    // Published once the record is filled in
+        bool retired;   // Freed by the user, destroyed once its frame has completed
+        bool pinned;    // Referenced by other records, never moved by defragmentation
+        bool move_source;   // Holds the old placement of a buffer moved by defragmentation
+        std::atomic<uint32_t> transfers;    // Unfinished transfer batches using the buffer, never moved while nonzero
+        uint64_t retired_frame;
+        uint32_t next_retired;  // Next record in the list of records retired since the last begin_frame
+    };
+
+    // Block sizes of a memory heap. The first block of a memory type is initial_block_size,
+    // each further block doubles up to max_block_size. Larger allocations get their own block.
+    struct BlockSizeConfig {
+        vk::DeviceSize initial_block_size;
+        vk::DeviceSize max_block_size;
+        vk::DeviceSize dedicated_threshold;
+    };
+
+    struct MemoryStats {
+        uint32_t block_count = 0;
+        vk::DeviceSize reserved = 0;        // Device memory held in blocks
+        vk::DeviceSize used = 0;            // Bytes handed out from those blocks
+        uint32_t allocation_count = 0;
+        vk::DeviceSize largest_free = 0;    // Largest range a single allocation can still use
+        vk::DeviceSize peak_used = 0;
+        vk::DeviceSize committed = 0;       // Physical memory behind reserved, less for lazily allocated types
+
+        // 0 when all free space is one range, approaches 1 as it splits into small holes
+        float fragmentation() const;
+    };
+
+    struct HeapStats : MemoryStats {
+        vk::DeviceSize size = 0;
+        vk::DeviceSize budget = 0;  // Reported by VK_EXT_memory_budget, estimated otherwise
+        vk::DeviceSize usage = 0;   // Includes other processes with VK_EXT_memory_budget
+    };
+
+    struct Statistics {
+        std::vector<MemoryStats> types;
+        std::vector<HeapStats> heaps;
+        bool memory_budget = false;     // Heap budgets come from VK_EXT_memory_budget
+    };
+
+    struct DefragmentationStats {
+        vk::DeviceSize bytes_moved = 0;
+        uint32_t allocations_moved = 0;
+        vk::DeviceSize bytes_reclaimed = 0;    // Device memory returned to the driver
+    };
+
+    struct DeferredFree {
+        uint64_t frame;
+        uint32_t index;
+    };
+
+    /**
+     * Creation, free and lookup may be called from any thread. Slab slots and record indices
+     * come from per-thread caches and frees are pushed onto a lock free list, so small buffers
+     * only take a lock to move a batch between caches. Blocks and slab pools have their own
+     * lock. begin_frame, flush_frees, defragment and destroy belong to the render thread.
+     */
     class Manager {
         public:
         Manager() {};
-        Manager(vk::PhysicalDevice *p_physical_device, vk::Device *p_device, vk::Queue *p_queue, vk::CommandPool *p_command_pool);
+        explicit Manager(std::unique_ptr<Device> device);
 
-        uint32_t find_memory_type(const vk::MemoryRequirements &mem_req, const vk::MemoryPropertyFlags property_flags);
+        uint32_t find_memory_type(const vk::MemoryRequirements &mem_req, const MemoryPreference &preference);
 
         BufferHandle create_transfer_buffer(const vk::DeviceSize size);
         BufferHandle create_vertex_buffer(const vk::DeviceSize size);
         BufferHandle create_index_buffer(const vk::DeviceSize size);
         BufferHandle create_uniform_buffer(const vk::DeviceSize size);
-        void copy_buffer(BufferHandle &src, BufferHandle &dst);
-        void copy_buffer(BufferHandle &src_handle, vk::Image &dst_image, uint32_t width, uint32_t height, const vk::Format &format, const vk::ImageLayout &old_layout);
+        // Host visible, preferably host cached, for reading GPU results on the CPU
+        BufferHandle create_readback_buffer(const vk::DeviceSize size);
+        // Any usage and memory preference, never packed into a slab
+        BufferHandle create_buffer(const vk::DeviceSize size, const vk::BufferUsageFlags usage_flags, const MemoryPreference &preference);
         void free(const BufferHandle &handle);
+        // Only for buffers the GPU is known to be done with, e.g. staging behind a signaled fence
+        void free_immediate(const BufferHandle &handle);
         BufferContainer get_buffer(const BufferHandle &handle);
-        void* mapMemory(const BufferHandle &handle, const vk::MemoryMapFlags flags = vk::MemoryMapFlags());
+        // Keeps a buffer in place until a transfer batch recorded with it has completed.
+        // Hold before resolving the buffer, release ignores buffers that have since been destroyed.
+        void hold_for_transfer(const BufferHandle &handle);
+        void release_from_transfer(const BufferHandle &handle);
+
+        ImageHandle create_image(const vk::ImageCreateInfo &create_info, const MemoryPreference &preference = MemoryPreference {vk::MemoryPropertyFlagBits::eDeviceLocal});
+        /**
+         * Color, depth or input attachment that is never loaded or stored, such as depth, MSAA or
+         * G-buffer targets resolved within a render pass. Placed in lazily allocated memory when
+         * the device has it, which tilers only back with physical memory if the tile contents
+         * spill, and in device local memory otherwise. Lazily allocated images are dedicated so
+         * their commitment can be queried.
+         */
+        ImageHandle create_transient_attachment(const vk::Format format, const vk::Extent2D &extent, const vk::ImageUsageFlags usage, const vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1);
+        // Physical memory behind an image, below its size only for lazily allocated memory
+        vk::DeviceSize get_committed_size(const ImageHandle &handle);
+        void free_image(const ImageHandle &handle);
+        ImageContainer get_image(const ImageHandle &handle);
+
+        // Host visible blocks stay mapped, these only hand out and release the CPU pointer.
+        // unmapMemory flushes the whole buffer if its memory is not host coherent.
+        void* mapMemory(const BufferHandle &handle);
         void unmapMemory(const BufferHandle &handle);
 
+        // No-ops on host coherent memory, ranges are widened to nonCoherentAtomSize
+        void flush(const BufferHandle &handle, const vk::DeviceSize offset = 0, const vk::DeviceSize size = VK_WHOLE_SIZE);
+        void invalidate(const BufferHandle &handle, const vk::DeviceSize offset = 0, const vk::DeviceSize size = VK_WHOLE_SIZE);
+
+        bool is_host_visible(const BufferHandle &handle);
+
+        /**
+         * Frees are deferred until the frame they were issued in has completed on the GPU.
+         * frame is the frame about to be recorded, completed_frames the number of frames
+         * whose fences are known to have signaled. Frame numbers may be any monotonic
+         * counter, such as timeline semaphore values.
+         */
+        void begin_frame(const uint64_t frame, const uint64_t completed_frames);
+        // Destroys everything still queued, the device must be idle
+        void flush_frees();
+
+        /**
+         * Evacuates the sparsest block of each memory type into the other blocks, copying at
+         * most byte_budget bytes. Copies are recorded into command_buffer, which must be
+         * outside a render pass and submitted this frame. Old buffers are destroyed through
+         * the deferred free queue, blocks left empty are released on a later pass.
+         *
+         * Only device local buffers are moved, images and host visible memory stay in place.
+         * Blocks holding an image, a slab, a pinned buffer or a buffer held by an unfinished
+         * transfer batch are never picked as the source.
+         * Cheap to call every frame, records are only scanned after a block was added or freed from.
+         */
+        DefragmentationStats defragment(vk::CommandBuffer &command_buffer, const vk::DeviceSize byte_budget);
+
+        // Only affects blocks allocated afterwards
+        void set_block_sizes(const uint32_t heap, const BlockSizeConfig &config);
+        const BlockSizeConfig& get_block_sizes(const uint32_t heap) const;
+
+        /**
+         * Records every placement, free, map, unmap and frame boundary to a binary trace
+         * that tools/vk_mem_replay can replay without a GPU. Safe to toggle while other
+         * threads allocate, their events land in whichever trace they picked up.
+         */
+        void start_trace(const std::string &filename);
+        void stop_trace();
+        bool is_tracing() const;
+
+        Statistics get_statistics();
+        void dump_statistics(std::ostream &stream);
+
+        const vk::PhysicalDeviceLimits& get_limits() const;
+
         void destroy();
 
         private:
 
-        std::map<uint32_t, MemoryBlock> memory_blocks;
+        std::map<uint32_t, std::vector<std::unique_ptr<MemoryBlock>>> memory_blocks;
+        bool defragment_pending = false;    // A block was added or became sparser since the last pass
+
+        struct Sync {
+            std::mutex blocks;      // memory_blocks, block allocators, block sizes and defragment_pending
+            std::shared_mutex pools; // slab_pools, held exclusively to add a pool
+            std::shared_mutex moves; // Held exclusively while defragmentation rewrites records
+            std::atomic<uint32_t> record_count {0};
+            std::atomic<uint32_t> retired {NO_RECORD};  // Newest record retired since the last begin_frame
+            std::atomic<uint64_t> current_frame {0};
+            std::atomic<bool> tracing {false};  // Lets allocation paths skip the trace pointer when not tracing
+        };
+        // Kept behind a pointer so the Manager itself stays movable
+        std::unique_ptr<Sync> sync;
+
+        using RecordChunk = std::array<AllocationRecord, RECORD_CHUNK_SIZE>;
+        std::array<std::unique_ptr<RecordChunk>, MAX_RECORD_CHUNKS> record_chunks;
+        std::unique_ptr<thread_cache::Cache<uint32_t>> record_cache;  // Free record indices, chunks are created by its refill
+        std::deque<DeferredFree> deferred_frees;    // Retired records taken over by the render thread
+
+        std::map<SlabPoolKey, SlabPool> slab_pools;
 
-        vk::PhysicalDevice *p_physical_device;
-        vk::Device *p_device;
-        vk::Queue *p_queue;
-        vk::CommandPool *p_command_pool;
+        vk::PhysicalDeviceLimits limits;
+        vk::PhysicalDeviceMemoryProperties memory_properties;
+        std::array<vk::DeviceSize, VK_MAX_MEMORY_TYPES> peak_used = {};
+        std::array<vk::DeviceSize, VK_MAX_MEMORY_HEAPS> heap_peak_used = {};
+        std::vector<BlockSizeConfig> block_sizes;
+        std::shared_ptr<alloc_trace::Writer> trace;    // Swapped with atomic_store, read through active_trace
 
-        BufferHandle create_buffer(const uint32_t size, const vk::BufferUsageFlags usage_flags, const vk::MemoryPropertyFlags properties);
+        std::unique_ptr<Device> device;
+
+        BufferHandle create_pooled_buffer(const vk::DeviceSize size, const vk::BufferUsageFlags usage_flags, const MemoryPreference &preference);
+        BufferHandle create_block_buffer(const vk::DeviceSize size, const vk::BufferUsageFlags usage_flags, const MemoryPreference &preference, const bool pinned);
+        MemoryBlock* allocate(const vk::MemoryRequirements &mem_reqs, const uint32_t memory_type, const uint32_t pool, const vk::MemoryDedicatedAllocateInfo *dedicated_info, tlsf::Allocation &allocation);
+        vk::DeviceSize next_block_size(const uint32_t memory_type, const uint32_t pool, const vk::DeviceSize required);
+        void release_dedicated(MemoryBlock *block);
+        uint32_t block_pool(const uint32_t memory_type, const bool optimal_image) const;
+        void release_block(MemoryBlock &block);
+        void track_peak(const uint32_t memory_type);
+        bool move_buffer(vk::CommandBuffer &command_buffer, const uint32_t index, std::vector<std::unique_ptr<MemoryBlock>> &blocks);
+
+        AllocationRecord& resolve(const uint32_t index, const uint32_t generation);
+        AllocationRecord& resolve(const BufferHandle &handle);
+        AllocationRecord& resolve(const ImageHandle &handle);
+        AllocationRecord& record_at(const uint32_t index);
+        std::shared_ptr<alloc_trace::Writer> active_trace() const;
+        void trace_event(alloc_trace::Writer &writer, alloc_trace::Event &event, const uint32_t index);
+        vk::MappedMemoryRange atom_range(const AllocationRecord &record, const vk::DeviceSize offset, const vk::DeviceSize size);
+        uint32_t new_record(MemoryBlock *block, const uint32_t type, const vk::DeviceSize offset);
+        void publish_record(const uint32_t index);
+        void release_record(const uint32_t index);
+        void retire_record(const uint32_t index);
+        void destroy_record(const uint32_t index);
+        void collect_retired();
         vk::DeviceMemory get_memory(const BufferHandle &handle);
+    };
 
-        vk::CommandBuffer begin_one_time_command();
-        void end_one_time_command(vk::CommandBuffer &command_buffer);
-        void layout_transition(vk::Image image, const vk::Format &format, const vk::ImageLayout &old_layout, const vk::ImageLayout &new_layout);
-        
+    struct RingAllocation {
+        void *data;
+        uint32_t offset;    // Dynamic offset from the start of the ring buffer
+    };
+
+    // Linear allocator for per-frame uniform data. One persistently mapped uniform buffer
+    // is split into a region per frame in flight, a region is rewound by begin_frame once
+    // the fence of the frame that last used it has signaled.
+    class FrameRing {
+        public:
+        FrameRing() {};
+        FrameRing(Manager *p_manager, const vk::DeviceSize frame_size, const uint32_t frame_count);
+
+        void begin_frame(const uint32_t frame);
+        RingAllocation allocate(const vk::DeviceSize size);
+        BufferContainer get_buffer();
+
+        template<typename T>
+        uint32_t push(const T &value) {
+            RingAllocation allocation = allocate(sizeof(T));
+            memcpy(allocation.data, &value, sizeof(T));
+            return allocation.offset;
+        }
+
+        private:
+        Manager *p_manager;
+        BufferHandle buffer;
+        char *data;
+        vk::DeviceSize alignment;
+        vk::DeviceSize frame_size;
+        vk::DeviceSize head;
+        vk::DeviceSize end;
     };
 
 }
@@ -0,0 +1,661 @@
+#include "vulkan_transfer.hpp"
+#include "texture_formats.hpp"
+#include <iostream>
+#include <limits>
+#include <algorithm>
+
+namespace vk_mem {
+
+    struct layout_transition_flags {
+        vk::AccessFlags src_mask;
+        vk::AccessFlags dst_mask;
+        vk::PipelineStageFlags src_stage;
+        vk::PipelineStageFlags dst_stage;
+    };
+
+    constexpr layout_transition_flags get_layout_transition_flags(const vk::ImageLayout &old_layout, const vk::ImageLayout &new_layout) {
+        if (old_layout == vk::ImageLayout::eUndefined && new_layout == vk::ImageLayout::eTransferDstOptimal) {
+            return layout_transition_flags {
+                vk::AccessFlags(),
+                vk::AccessFlagBits::eTransferWrite,
+                vk::PipelineStageFlagBits::eTopOfPipe,
+                vk::PipelineStageFlagBits::eTransfer
+            };
+        } else if (old_layout == vk::ImageLayout::eTransferDstOptimal && new_layout == vk::ImageLayout::eShaderReadOnlyOptimal) {
+            return layout_transition_flags {
+                vk::AccessFlagBits::eTransferWrite,
+                vk::AccessFlagBits::eShaderRead,
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eFragmentShader
+            };
+        } else if (old_layout == vk::ImageLayout::eTransferDstOptimal && new_layout == vk::ImageLayout::eTransferSrcOptimal) {
+            return layout_transition_flags {
+                vk::AccessFlagBits::eTransferWrite,
+                vk::AccessFlagBits::eTransferRead,
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eTransfer
+            };
+        } else if (old_layout == vk::ImageLayout::eTransferSrcOptimal && new_layout == vk::ImageLayout::eShaderReadOnlyOptimal) {
+            return layout_transition_flags {
+                vk::AccessFlagBits::eTransferRead,
+                vk::AccessFlagBits::eShaderRead,
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eFragmentShader
+            };
+        } else {
+            throw std::invalid_argument("Unsupported layout transition");
+        }
+    }
+
+    TransferQueue::TransferQueue(Manager *p_manager, vk::Device *p_device, const QueueContext &transfer, const QueueContext &graphics)
+        : p_manager(p_manager), p_device(p_device), transfer(transfer), graphics(graphics) {
+        dedicated = transfer.family != graphics.family;
+        if (dedicated) {
+            std::cout << "Uploading on dedicated transfer queue family " << transfer.family << std::endl;
+        }
+    }
+
+    vk::CommandBuffer& TransferQueue::command_buffer() {
+        if (is_recording) {
+            return recording.command_buffer;
+        }
+
+        if (!idle.empty()) {
+            recording = idle.back();
+            idle.pop_back();
+        } else {
+            vk::CommandBufferAllocateInfo alloc_info(
+                *transfer.p_command_pool,
+                vk::CommandBufferLevel::ePrimary,
+                1
+            );
+
+            recording = Batch();
+            recording.command_buffer = p_device->allocateCommandBuffers(alloc_info)[0];
+            recording.fence = p_device->createFence(vk::FenceCreateInfo());
+
+            if (dedicated) {
+                vk::CommandBufferAllocateInfo acquire_alloc_info(
+                    *graphics.p_command_pool,
+                    vk::CommandBufferLevel::ePrimary,
+                    1
+                );
+
+                recording.acquire_command_buffer = p_device->allocateCommandBuffers(acquire_alloc_info)[0];
+                recording.semaphore = p_device->createSemaphore(vk::SemaphoreCreateInfo());
+            }
+        }
+
+        vk::CommandBufferBeginInfo begin_info(
+            vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+        );
+
+        recording.command_buffer.begin(begin_info);
+        is_recording = true;
+
+        return recording.command_buffer;
+    }
+
+    void TransferQueue::layout_transition(vk::CommandBuffer &command_buffer, const vk::Image &image, const vk::ImageLayout &old_layout, const vk::ImageLayout &new_layout, const uint32_t base_level, const uint32_t level_count) {
+
+        auto layout_transition = get_layout_transition_flags(old_layout, new_layout);
+
+        vk::ImageMemoryBarrier barrier(
+            layout_transition.src_mask, // Src access mask
+            layout_transition.dst_mask, // Dst access mask
+            old_layout, // Old layout
+            new_layout, // New layout
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            image,
+            vk::ImageSubresourceRange(
+                vk::ImageAspectFlagBits::eColor,
+                base_level,     // Base mip level
+                level_count,    // Level count
+                0,              // Base array layer
+                1               // Layer count
+            )
+        );
+
+        command_buffer.pipelineBarrier(
+            layout_transition.src_stage,   // Src stage
+            layout_transition.dst_stage,   // Dst stage
+            vk::DependencyFlags(),      // Dependency flags
+            nullptr,                    // Memory barrier
+            nullptr,                    // Buffer barrier
+            barrier                     // Image barrier
+        );
+    }
+
+    void TransferQueue::transfer_ownership(const BufferContainer &buffer) {
+        vk::BufferMemoryBarrier release(
+            vk::AccessFlagBits::eTransferWrite, // Src access mask
+            vk::AccessFlags(),                  // Dst access mask
+            transfer.family,                    // Src queue family
+            graphics.family,                    // Dst queue family
+            buffer,                             // Buffer
+            buffer.buffer_offset,               // Offset
+            buffer.size                         // Size
+        );
+
+        vk::BufferMemoryBarrier acquire = release;
+        acquire.srcAccessMask = vk::AccessFlags();
+        acquire.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead;
+
+        recording.buffer_releases.push_back(release);
+        recording.buffer_acquires.push_back(acquire);
+    }
+
+    void TransferQueue::transfer_ownership(const vk::Image &image, const vk::ImageLayout &old_layout, const vk::ImageLayout &new_layout, const uint32_t level_count) {
+        // The layout transition is part of the ownership transfer and must match on both queues
+        vk::ImageMemoryBarrier release(
+            vk::AccessFlagBits::eTransferWrite, // Src access mask
+            vk::AccessFlags(),                  // Dst access mask
+            old_layout,                         // Old layout
+            new_layout,                         // New layout
+            transfer.family,                    // Src queue family
+            graphics.family,                    // Dst queue family
+            image,
+            vk::ImageSubresourceRange(
+                vk::ImageAspectFlagBits::eColor,
+                0,              // Base mip level
+                level_count,    // Level count
+                0,              // Base array layer
+                1               // Layer count
+            )
+        );
+
+        // Images still in transfer layout are written by blits on the graphics queue next
+        vk::ImageMemoryBarrier acquire = release;
+        acquire.srcAccessMask = vk::AccessFlags();
+        acquire.dstAccessMask = new_layout == vk::ImageLayout::eTransferDstOptimal
+            ? vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite
+            : vk::AccessFlagBits::eShaderRead;
+
+        recording.image_releases.push_back(release);
+        recording.image_acquires.push_back(acquire);
+    }
+
+    // Defragmentation must not move a buffer between recording a copy and the copy completing
+    void TransferQueue::hold(const BufferHandle &handle) {
+        command_buffer();
+        p_manager->hold_for_transfer(handle);
+        recording.held.push_back(handle);
+    }
+
+    void TransferQueue::copy_buffer(const BufferHandle &src_handle, const BufferHandle &dst_handle) {
+        hold(src_handle);
+        hold(dst_handle);
+        BufferContainer src = p_manager->get_buffer(src_handle);
+        BufferContainer dst = p_manager->get_buffer(dst_handle);
+
+        if (dst.size < src.size) {
+            throw std::runtime_error("Error: Attempting to copy to a undersized buffer");
+        }
+
+        vk::BufferCopy copy_region(
+            src.buffer_offset,  // Source offset
+            dst.buffer_offset,  // Destination offset
+            src.size            // Size
+        );
+
+        command_buffer().copyBuffer(src, dst, copy_region);
+
+        if (dedicated) {
+            transfer_ownership(dst);
+        }
+    }
+
+    void TransferQueue::copy_buffer(const BufferHandle &src_handle, const vk::Image &dst_image, uint32_t width, uint32_t height, const vk::ImageLayout &old_layout, const vk::DeviceSize src_offset, const uint32_t level_count, const vk::Format &format) {
+        BufferContainer src = p_manager->get_buffer(src_handle);
+
+        auto &cmd = command_buffer();
+
+        layout_transition(cmd, dst_image, old_layout, vk::ImageLayout::eTransferDstOptimal, 0, level_count);
+
+        std::vector<vk::BufferImageCopy> copy_regions;
+        vk::DeviceSize offset = src.buffer_offset + src_offset;
+        for (uint32_t level = 0; level < level_count; level++) {
+            uint32_t level_width = std::max(1u, width >> level);
+            uint32_t level_height = std::max(1u, height >> level);
+
+            copy_regions.push_back(vk::BufferImageCopy(
+                offset,             // Buffer offset
+                0,                  // Buffer row length
+                0,                  // Buffer image height
+                vk::ImageSubresourceLayers(
+                    vk::ImageAspectFlagBits::eColor,
+                    level,  // Mip level
+                    0,      // Base array layer
+                    1       // Layer count
+                ),
+                vk::Offset3D(),                             // Offset
+                vk::Extent3D(level_width, level_height, 1)  // Extent
+            ));
+            offset += vk_help::get_level_size(format, width, height, level);
+        }
+
+        cmd.copyBufferToImage(src, dst_image, vk::ImageLayout::eTransferDstOptimal, copy_regions);
+
+        if (dedicated) {
+            transfer_ownership(dst_image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, level_count);
+        } else {
+            layout_transition(cmd, dst_image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, 0, level_count);
+        }
+    }
+
+    void TransferQueue::copy_buffer_generate_mips(const BufferHandle &src_handle, const vk::Image &dst_image, uint32_t width, uint32_t height, const uint32_t level_count, const vk::ImageLayout &old_layout, const vk::DeviceSize src_offset) {
+        BufferContainer src = p_manager->get_buffer(src_handle);
+
+        auto &cmd = command_buffer();
+
+        layout_transition(cmd, dst_image, old_layout, vk::ImageLayout::eTransferDstOptimal, 0, level_count);
+
+        vk::BufferImageCopy copy_region(
+            src.buffer_offset + src_offset, // Buffer offset
+            0,                  // Buffer row length
+            0,                  // Buffer image height
+            vk::ImageSubresourceLayers(
+                vk::ImageAspectFlagBits::eColor,
+                0,  // Mip level
+                0,  // Base array layer
+                1   // Layer count
+            ),
+            vk::Offset3D(),                 // Offset
+            vk::Extent3D(width, height, 1)  // Extent
+        );
+
+        cmd.copyBufferToImage(src, dst_image, vk::ImageLayout::eTransferDstOptimal, copy_region);
+
+        MipChain chain = {dst_image, width, height, level_count};
+        if (dedicated) {
+            transfer_ownership(dst_image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferDstOptimal, level_count);
+            recording.mip_chains.push_back(chain);
+        } else {
+            record_mip_chain(cmd, chain);
+        }
+    }
+
+    // Expects every level in transfer dst layout and leaves them shader readable
+    void TransferQueue::record_mip_chain(vk::CommandBuffer &command_buffer, const MipChain &chain) {
+        int32_t src_width = (int32_t)chain.width;
+        int32_t src_height = (int32_t)chain.height;
+
+        for (uint32_t level = 1; level < chain.level_count; level++) {
+            int32_t dst_width = std::max(1, src_width / 2);
+            int32_t dst_height = std::max(1, src_height / 2);
+
+            layout_transition(command_buffer, chain.image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferSrcOptimal, level - 1);
+
+            vk::ImageBlit blit(
+                vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level - 1, 0, 1),       // Src subresource
+                {{vk::Offset3D(0, 0, 0), vk::Offset3D(src_width, src_height, 1)}},                  // Src offsets
+                vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1),           // Dst subresource
+                {{vk::Offset3D(0, 0, 0), vk::Offset3D(dst_width, dst_height, 1)}}                   // Dst offsets
+            );
+
+            command_buffer.blitImage(
+                chain.image, vk::ImageLayout::eTransferSrcOptimal,
+                chain.image, vk::ImageLayout::eTransferDstOptimal,
+                blit,
+                vk::Filter::eLinear
+            );
+
+            layout_transition(command_buffer, chain.image, vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, level - 1);
+
+            src_width = dst_width;
+            src_height = dst_height;
+        }
+
+        layout_transition(command_buffer, chain.image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, chain.level_count - 1);
+    }
+
+    void TransferQueue::upload(const void *data, const vk::DeviceSize size, const BufferHandle &dst_handle) {
+        // Host visible destinations, such as on unified memory, skip the staging copy
+        if (p_manager->is_host_visible(dst_handle)) {
+            memcpy(p_manager->mapMemory(dst_handle), data, (size_t) size);
+            p_manager->unmapMemory(dst_handle);
+            return;
+        }
+
+        BufferHandle staging_buffer = p_manager->create_transfer_buffer(size);
+
+        memcpy(p_manager->mapMemory(staging_buffer), data, (size_t) size);
+        p_manager->unmapMemory(staging_buffer);
+
+        copy_buffer(staging_buffer, dst_handle);
+        free_after_upload(staging_buffer);
+    }
+
+    void TransferQueue::upload(const void *data, const vk::DeviceSize size, const vk::Image &dst_image, uint32_t width, uint32_t height, const vk::ImageLayout &old_layout) {
+        BufferHandle staging_buffer = p_manager->create_transfer_buffer(size);
+
+        memcpy(p_manager->mapMemory(staging_buffer), data, (size_t) size);
+        p_manager->unmapMemory(staging_buffer);
+
+        copy_buffer(staging_buffer, dst_image, width, height, old_layout);
+        free_after_upload(staging_buffer);
+    }
+
+    std::future<std::vector<uint8_t>> TransferQueue::add_readback(const ReadbackCopy &copy) {
+        // Makes sure a batch is being recorded, the copy itself is recorded on submit
+        command_buffer();
+        recording.readbacks.push_back(copy);
+
+        PendingReadback pending;
+        pending.ticket = next_ticket;
+        pending.buffer = copy.readback;
+        pending.size = copy.size;
+        std::future<std::vector<uint8_t>> future = pending.promise.get_future();
+        pending_readbacks.push_back(std::move(pending));
+        return future;
+    }
+
+    std::future<std::vector<uint8_t>> TransferQueue::readback(const BufferHandle &src_handle, const vk::DeviceSize offset, const vk::DeviceSize size) {
+        ReadbackCopy copy = {};
+        copy.readback = p_manager->create_readback_buffer(size);
+        copy.src_buffer = src_handle;
+        hold(src_handle);
+        copy.src_offset = offset;
+        copy.size = size;
+        return add_readback(copy);
+    }
+
+    std::future<std::vector<uint8_t>> TransferQueue::readback(const vk::Image &src_image, uint32_t width, uint32_t height, const vk::DeviceSize size, const vk::ImageLayout &layout) {
+        ReadbackCopy copy = {};
+        copy.readback = p_manager->create_readback_buffer(size);
+        copy.size = size;
+        copy.src_image = src_image;
+        copy.layout = layout;
+        copy.width = width;
+        copy.height = height;
+        return add_readback(copy);
+    }
+
+    // Records into a command buffer on the graphics queue, which owns the resources being read
+    void TransferQueue::record_readbacks(vk::CommandBuffer &command_buffer) {
+        if (recording.readbacks.empty()) {
+            return;
+        }
+
+        vk::MemoryBarrier before(vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eTransferRead);
+        command_buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eAllCommands,
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::DependencyFlags(),
+            before, nullptr, nullptr
+        );
+
+        for (auto &copy : recording.readbacks) {
+            BufferContainer dst = p_manager->get_buffer(copy.readback);
+
+            if (copy.src_buffer.generation != 0) {
+                BufferContainer src = p_manager->get_buffer(copy.src_buffer);
+                vk::BufferCopy copy_region(
+                    src.buffer_offset + copy.src_offset,    // Source offset
+                    dst.buffer_offset,                      // Destination offset
+                    copy.size                               // Size
+                );
+                command_buffer.copyBuffer(src, dst, copy_region);
+                continue;
+            }
+
+            vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+            vk::ImageMemoryBarrier to_transfer(
+                vk::AccessFlagBits::eMemoryWrite,
+                vk::AccessFlagBits::eTransferRead,
+                copy.layout,
+                vk::ImageLayout::eTransferSrcOptimal,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                copy.src_image,
+                range
+            );
+            command_buffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eAllCommands,
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::DependencyFlags(),
+                nullptr, nullptr, to_transfer
+            );
+
+            vk::BufferImageCopy copy_region(
+                dst.buffer_offset,  // Buffer offset
+                0,                  // Buffer row length
+                0,                  // Buffer image height
+                vk::ImageSubresourceLayers(
+                    vk::ImageAspectFlagBits::eColor,
+                    0,  // Mip level
+                    0,  // Base array layer
+                    1   // Layer count
+                ),
+                vk::Offset3D(),                             // Offset
+                vk::Extent3D(copy.width, copy.height, 1)    // Extent
+            );
+            command_buffer.copyImageToBuffer(copy.src_image, vk::ImageLayout::eTransferSrcOptimal, dst, copy_region);
+
+            vk::ImageMemoryBarrier restore(
+                vk::AccessFlagBits::eTransferRead,
+                vk::AccessFlags(),
+                vk::ImageLayout::eTransferSrcOptimal,
+                copy.layout,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                copy.src_image,
+                range
+            );
+            command_buffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eBottomOfPipe,
+                vk::DependencyFlags(),
+                nullptr, nullptr, restore
+            );
+        }
+
+        // Make the copies visible to host reads once the fence has signaled
+        vk::MemoryBarrier after(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+        command_buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eHost,
+            vk::DependencyFlags(),
+            after, nullptr, nullptr
+        );
+
+        recording.readbacks.clear();
+    }
+
+    void TransferQueue::resolve_readbacks() {
+        while (!pending_readbacks.empty() && pending_readbacks.front().ticket <= completed_ticket) {
+            PendingReadback &pending = pending_readbacks.front();
+
+            p_manager->invalidate(pending.buffer);
+            const uint8_t *data = static_cast<const uint8_t*>(p_manager->mapMemory(pending.buffer));
+            pending.promise.set_value(std::vector<uint8_t>(data, data + pending.size));
+            p_manager->free_immediate(pending.buffer);
+
+            pending_readbacks.pop_front();
+        }
+    }
+
+    void TransferQueue::free_after_upload(const BufferHandle &handle) {
+        if (is_recording) {
+            recording.staging.push_back(handle);
+        } else if (!in_flight.empty()) {
+            in_flight.back().staging.push_back(handle);
+        } else {
+            p_manager->free_immediate(handle);
+        }
+    }
+
+    UploadTicket TransferQueue::submit() {
+        if (!is_recording) {
+            return UploadTicket {next_ticket - 1};
+        }
+
+        if (dedicated) {
+            // Release ownership on the transfer queue ...
+            recording.command_buffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eBottomOfPipe,
+                vk::DependencyFlags(),
+                nullptr,
+                recording.buffer_releases,
+                recording.image_releases
+            );
+
+            recording.command_buffer.end();
+
+            vk::SubmitInfo transfer_submit_info(0, nullptr, nullptr, 1, &recording.command_buffer, 1, &recording.semaphore);
+
+            transfer.p_queue->submit(transfer_submit_info, nullptr);
+
+            // ... and acquire it on the graphics queue once the copies have finished
+            vk::CommandBufferBeginInfo begin_info(
+                vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+            );
+
+            recording.acquire_command_buffer.begin(begin_info);
+
+            recording.acquire_command_buffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader,
+                vk::DependencyFlags(),
+                nullptr,
+                recording.buffer_acquires,
+                recording.image_acquires
+            );
+
+            for (auto &chain : recording.mip_chains) {
+                record_mip_chain(recording.acquire_command_buffer, chain);
+            }
+            recording.mip_chains.clear();
+
+            record_readbacks(recording.acquire_command_buffer);
+
+            recording.acquire_command_buffer.end();
+
+            vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eTransfer;
+            vk::SubmitInfo acquire_submit_info(1, &recording.semaphore, &wait_stage, 1, &recording.acquire_command_buffer, 0, nullptr);
+
+            graphics.p_queue->submit(acquire_submit_info, recording.fence);
+
+            recording.buffer_releases.clear();
+            recording.buffer_acquires.clear();
+            recording.image_releases.clear();
+            recording.image_acquires.clear();
+        } else {
+            // Make transfer writes visible to any later use on this queue
+            vk::MemoryBarrier barrier(
+                vk::AccessFlagBits::eTransferWrite,
+                vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead
+            );
+
+            recording.command_buffer.pipelineBarrier(
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader,
+                vk::DependencyFlags(),
+                barrier,
+                nullptr,
+                nullptr
+            );
+
+            record_readbacks(recording.command_buffer);
+
+            recording.command_buffer.end();
+
+            vk::SubmitInfo submit_info(0, nullptr, nullptr, 1, &recording.command_buffer, 0, nullptr);
+
+            graphics.p_queue->submit(submit_info, recording.fence);
+        }
+
+        recording.ticket = next_ticket++;
+
+        in_flight.push_back(recording);
+        is_recording = false;
+
+        return UploadTicket {recording.ticket};
+    }
+
+    void TransferQueue::retire(Batch &batch) {
+        for (auto &handle : batch.staging) {
+            p_manager->free_immediate(handle);
+        }
+        batch.staging.clear();
+        for (auto &handle : batch.held) {
+            p_manager->release_from_transfer(handle);
+        }
+        batch.held.clear();
+        p_device->resetFences(1, &batch.fence);
+        idle.push_back(batch);
+    }
+
+    void TransferQueue::collect() {
+        while (!in_flight.empty() && p_device->getFenceStatus(in_flight.front().fence) == vk::Result::eSuccess) {
+            completed_ticket = in_flight.front().ticket;
+            retire(in_flight.front());
+            in_flight.pop_front();
+        }
+        resolve_readbacks();
+    }
+
+    bool TransferQueue::is_complete(const UploadTicket &ticket) {
+        collect();
+        return ticket.value <= completed_ticket;
+    }
+
+    void TransferQueue::wait(const UploadTicket &ticket) {
+        if (ticket.value >= next_ticket) {
+            throw std::runtime_error("Waiting on an upload that was never submitted");
+        }
+
+        for (auto &batch : in_flight) {
+            if (batch.ticket <= ticket.value) {
+                p_device->waitForFences(1, &batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+            }
+        }
+
+        collect();
+    }
+
+    void TransferQueue::destroy() {
+        if (is_recording) {
+            recording.command_buffer.end();
+            for (auto &handle : recording.staging) {
+                p_manager->free_immediate(handle);
+            }
+            recording.staging.clear();
+            for (auto &handle : recording.held) {
+                p_manager->release_from_transfer(handle);
+            }
+            recording.held.clear();
+            recording.buffer_releases.clear();
+            recording.buffer_acquires.clear();
+            recording.image_releases.clear();
+            recording.image_acquires.clear();
+            recording.readbacks.clear();
+            recording.mip_chains.clear();
+            idle.push_back(recording);
+            is_recording = false;
+
+            // Readbacks of the unsubmitted batch never run
+            while (!pending_readbacks.empty() && pending_readbacks.back().ticket == next_ticket) {
+                PendingReadback &pending = pending_readbacks.back();
+                pending.promise.set_exception(std::make_exception_ptr(std::runtime_error("Readback cancelled")));
+                p_manager->free_immediate(pending.buffer);
+                pending_readbacks.pop_back();
+            }
+        }
+
+        wait(UploadTicket {next_ticket - 1});
+
+        for (auto &batch : idle) {
+            p_device->destroyFence(batch.fence);
+            p_device->freeCommandBuffers(*transfer.p_command_pool, batch.command_buffer);
+            if (dedicated) {
+                p_device->destroySemaphore(batch.semaphore);
+                p_device->freeCommandBuffers(*graphics.p_command_pool, batch.acquire_command_buffer);
+            }
+        }
+        idle.clear();
+    }
+
+}
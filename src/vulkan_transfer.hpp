@@ -0,0 +1,139 @@
+#ifndef VULKAN_TRANSFER_HPP
+#define VULKAN_TRANSFER_HPP
+
+#include "vulkan_memory.hpp"
+#include <deque>
+#include <future>
+
+namespace vk_mem {
+
+    struct UploadTicket {
+        uint64_t value = 0;
+    };
+
+    struct QueueContext {
+        vk::Queue *p_queue;
+        uint32_t family;
+        vk::CommandPool *p_command_pool;
+    };
+
+    // Records copies and layout transitions into one command buffer per batch.
+    // A batch is submitted with a single fence, its staging buffers are freed
+    // once that fence has signaled.
+    //
+    // When the transfer queue belongs to a different family than the graphics queue,
+    // copies run on the transfer queue and ownership of the destinations is released
+    // there and acquired on the graphics queue by a second command buffer that waits
+    // on a semaphore. With a shared family everything is recorded on one queue.
+    class TransferQueue {
+        public:
+        TransferQueue() {};
+        TransferQueue(Manager *p_manager, vk::Device *p_device, const QueueContext &transfer, const QueueContext &graphics);
+
+        // Writes host coherent destinations directly, everything else goes through a staging buffer
+        void upload(const void *data, const vk::DeviceSize size, const BufferHandle &dst_handle);
+        void upload(const void *data, const vk::DeviceSize size, const vk::Image &dst_image, uint32_t width, uint32_t height, const vk::ImageLayout &old_layout);
+
+        void copy_buffer(const BufferHandle &src_handle, const BufferHandle &dst_handle);
+        // src_offset is relative to the source buffer, e.g. a region of a staging ring.
+        // With several levels the source holds them tightly packed in the image format, largest first.
+        void copy_buffer(const BufferHandle &src_handle, const vk::Image &dst_image, uint32_t width, uint32_t height, const vk::ImageLayout &old_layout, const vk::DeviceSize src_offset = 0, const uint32_t level_count = 1, const vk::Format &format = vk::Format::eR8G8B8A8Unorm);
+
+        /**
+         * Copies level 0 and fills the remaining levels by blitting each from the one above with
+         * linear filtering, which the image format must support. Transfer only queue families need
+         * not support blits, so with a dedicated transfer queue the blits are recorded on the
+         * graphics queue after the ownership transfer.
+         */
+        void copy_buffer_generate_mips(const BufferHandle &src_handle, const vk::Image &dst_image, uint32_t width, uint32_t height, const uint32_t level_count, const vk::ImageLayout &old_layout, const vk::DeviceSize src_offset = 0);
+
+        /**
+         * Copies GPU data into a host cached readback buffer. The copy is recorded on the graphics
+         * queue after everything submitted there before the batch, and the future is resolved by
+         * collect() once the batch fence has signaled. Images are returned to layout afterwards.
+         */
+        std::future<std::vector<uint8_t>> readback(const BufferHandle &src_handle, const vk::DeviceSize offset, const vk::DeviceSize size);
+        std::future<std::vector<uint8_t>> readback(const vk::Image &src_image, uint32_t width, uint32_t height, const vk::DeviceSize size, const vk::ImageLayout &layout);
+
+        // Frees the buffer once everything recorded so far has completed
+        void free_after_upload(const BufferHandle &handle);
+
+        UploadTicket submit();
+        bool is_complete(const UploadTicket &ticket);
+        void wait(const UploadTicket &ticket);
+        void collect();
+
+        void destroy();
+
+        private:
+        struct ReadbackCopy {
+            BufferHandle readback;
+            BufferHandle src_buffer;    // Null handle for image copies
+            vk::DeviceSize src_offset;
+            vk::DeviceSize size;
+            vk::Image src_image;
+            vk::ImageLayout layout;
+            uint32_t width;
+            uint32_t height;
+        };
+
+        struct PendingReadback {
+            uint64_t ticket;
+            BufferHandle buffer;
+            vk::DeviceSize size;
+            std::promise<std::vector<uint8_t>> promise;
+        };
+
+        struct MipChain {
+            vk::Image image;
+            uint32_t width;
+            uint32_t height;
+            uint32_t level_count;
+        };
+
+        struct Batch {
+            vk::CommandBuffer command_buffer;
+            vk::CommandBuffer acquire_command_buffer;
+            vk::Semaphore semaphore;
+            vk::Fence fence;
+            std::vector<BufferHandle> staging;
+            std::vector<BufferHandle> held;     // Kept in place by the manager until the fence signals
+            std::vector<vk::BufferMemoryBarrier> buffer_releases;
+            std::vector<vk::BufferMemoryBarrier> buffer_acquires;
+            std::vector<vk::ImageMemoryBarrier> image_releases;
+            std::vector<vk::ImageMemoryBarrier> image_acquires;
+            std::vector<ReadbackCopy> readbacks;
+            std::vector<MipChain> mip_chains;
+            uint64_t ticket;
+        };
+
+        Manager *p_manager;
+        vk::Device *p_device;
+        QueueContext transfer;
+        QueueContext graphics;
+        bool dedicated;
+
+        Batch recording;
+        bool is_recording = false;
+        std::deque<Batch> in_flight;
+        std::vector<Batch> idle;
+        std::deque<PendingReadback> pending_readbacks;
+
+        uint64_t next_ticket = 1;
+        uint64_t completed_ticket = 0;
+
+        vk::CommandBuffer& command_buffer();
+        void hold(const BufferHandle &handle);
+        void layout_transition(vk::CommandBuffer &command_buffer, const vk::Image &image, const vk::ImageLayout &old_layout, const vk::ImageLayout &new_layout, const uint32_t base_level = 0, const uint32_t level_count = 1);
+        void transfer_ownership(const BufferContainer &buffer);
+        void transfer_ownership(const vk::Image &image, const vk::ImageLayout &old_layout, const vk::ImageLayout &new_layout, const uint32_t level_count = 1);
+        void record_mip_chain(vk::CommandBuffer &command_buffer, const MipChain &chain);
+        void retire(Batch &batch);
+        std::future<std::vector<uint8_t>> add_readback(const ReadbackCopy &copy);
+        void record_readbacks(vk::CommandBuffer &command_buffer);
+        void resolve_readbacks();
+    };
+
+}
+
+#endif
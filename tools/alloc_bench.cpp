@@ -0,0 +1,233 @@
+/*
+Allocator churn benchmark.
+
+Compares the TLSF placement used by vk_mem::Manager against the first-fit scan
+over a std::map it replaced. Only placement is measured, no Vulkan calls are made.
+
+The threads mode measures small allocation throughput from many threads, comparing
+a single mutex guarded free list with the per-thread caches used for slab slots.
+It isolates the cache, vk_mem_bench threads runs the same load on the Manager.
+
+Usage: alloc_bench [live allocations] [iterations]
+       alloc_bench threads [max threads] [operations per thread]
+*/
+
+#include "util/tlsf.hpp"
+#include "util/thread_cache.hpp"
+
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <map>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+namespace {
+    const uint64_t BLOCK_SIZE = 64 * 1024 * 1024;
+    const uint64_t SUBBLOCK_SIZE = 1024;
+
+    uint64_t integer_step(uint64_t val, uint64_t step) {
+        return ((val + step - 1) / step) * step;
+    }
+
+    // Placement logic of the old Manager::create_buffer, one block
+    struct FirstFit {
+        std::map<uint64_t, uint64_t> buffers;
+
+        bool allocate(uint64_t size, uint64_t &offset) {
+            uint64_t last_buffer_end = 0;
+            for (auto &[start, length] : buffers) {
+                if (integer_step(start - last_buffer_end, SUBBLOCK_SIZE) >= size) {
+                    break;
+                }
+                last_buffer_end = integer_step(start + length, SUBBLOCK_SIZE);
+            }
+            if (last_buffer_end + integer_step(size, SUBBLOCK_SIZE) > BLOCK_SIZE) {
+                return false;
+            }
+            buffers[last_buffer_end] = size;
+            offset = last_buffer_end;
+            return true;
+        }
+
+        void free(uint64_t offset) {
+            buffers.erase(offset);
+        }
+    };
+
+    struct Tlsf {
+        tlsf::Allocator allocator = tlsf::Allocator(BLOCK_SIZE, SUBBLOCK_SIZE);
+
+        bool allocate(uint64_t size, uint64_t &node) {
+            tlsf::Allocation allocation;
+            if (!allocator.allocate(size, 256, allocation)) {
+                return false;
+            }
+            node = allocation.node;
+            return true;
+        }
+
+        void free(uint64_t node) {
+            allocator.free((uint32_t)node);
+        }
+    };
+
+    const size_t SLOT_BATCH = 64;
+
+    // Refill used by both slot pools, stands in for creating a new slab
+    struct SlotSource {
+        std::atomic<uint32_t> next {0};
+
+        void refill(std::vector<uint32_t> &slots) {
+            uint32_t first = next.fetch_add(4096);
+            for (uint32_t i = 0; i < 4096; i++) {
+                slots.push_back(first + i);
+            }
+        }
+    };
+
+    struct MutexSlots {
+        SlotSource source;
+        std::mutex mutex;
+        std::vector<uint32_t> slots;
+
+        uint32_t acquire() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (slots.empty()) {
+                source.refill(slots);
+            }
+            uint32_t slot = slots.back();
+            slots.pop_back();
+            return slot;
+        }
+
+        void release(uint32_t slot) {
+            std::lock_guard<std::mutex> lock(mutex);
+            slots.push_back(slot);
+        }
+    };
+
+    struct CachedSlots {
+        SlotSource source;
+        thread_cache::Cache<uint32_t> cache = thread_cache::Cache<uint32_t>(SLOT_BATCH);
+
+        uint32_t acquire() {
+            uint32_t slot = 0;
+            cache.acquire(slot, [this](std::vector<uint32_t> &slots) { source.refill(slots); });
+            return slot;
+        }
+
+        void release(uint32_t slot) {
+            cache.release(slot);
+        }
+    };
+
+    // Every thread keeps a window of live slots and replaces a random one per operation
+    template<typename T>
+    double threaded(const std::string &name, size_t thread_count, size_t operations) {
+        T pool;
+
+        auto worker = [&pool, operations](size_t seed) {
+            std::mt19937 rng((uint32_t)seed);
+            std::vector<uint32_t> live;
+            for (size_t i = 0; i < 256; i++) {
+                live.push_back(pool.acquire());
+            }
+            for (size_t i = 0; i < operations; i++) {
+                size_t victim = rng() % live.size();
+                pool.release(live[victim]);
+                live[victim] = pool.acquire();
+            }
+            for (uint32_t slot : live) {
+                pool.release(slot);
+            }
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back(worker, i + 1);
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double mops = thread_count * operations / seconds / 1e6;
+        std::cout << name << ": " << mops << " M release+acquire/s" << std::endl;
+        return mops;
+    }
+
+    template<typename T>
+    double churn(const std::string &name, size_t live, size_t iterations) {
+        T allocator;
+        std::mt19937_64 rng(1234);
+        std::uniform_int_distribution<uint64_t> size_dist(256, 16 * 1024);
+
+        std::vector<uint64_t> ids;
+        ids.reserve(live);
+        for (size_t i = 0; i < live; i++) {
+            uint64_t id;
+            if (!allocator.allocate(size_dist(rng), id)) {
+                break;
+            }
+            ids.push_back(id);
+        }
+
+        size_t failed = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            size_t victim = rng() % ids.size();
+            allocator.free(ids[victim]);
+            if (!allocator.allocate(size_dist(rng), ids[victim])) {
+                ids[victim] = ids.back();
+                ids.pop_back();
+                ++failed;
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+        std::cout << name << ": " << ns << " ns per free+allocate";
+        if (failed > 0) {
+            std::cout << " (" << failed << " failed)";
+        }
+        std::cout << std::endl;
+        return ns;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "threads") {
+        size_t max_threads = argc > 2 ? std::stoul(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+        size_t operations = argc > 3 ? std::stoul(argv[3]) : 1000000;
+
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            std::cout << threads << " threads" << std::endl;
+            double locked = threaded<MutexSlots>("  mutex free list", threads, operations);
+            double cached = threaded<CachedSlots>("  thread caches  ", threads, operations);
+            std::cout << "  speedup " << cached / locked << "x" << std::endl;
+        }
+        return 0;
+    }
+
+    size_t iterations = argc > 2 ? std::stoul(argv[2]) : 100000;
+    std::vector<size_t> live_counts = {256, 1024, 4096};
+    if (argc > 1) {
+        live_counts = {std::stoul(argv[1])};
+    }
+
+    for (size_t live : live_counts) {
+        std::cout << "Churn with " << live << " live allocations" << std::endl;
+        double first_fit = churn<FirstFit>("  first-fit scan", live, iterations);
+        double tlsf = churn<Tlsf>("  tlsf          ", live, iterations);
+        std::cout << "  speedup " << first_fit / tlsf << "x" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+Startup asset loading, asset pack against loose files.
+
+Loads every asset of a pack both ways and copies it into a buffer standing in for
+the staging ring. Loose files are read with std::ifstream into a std::vector first,
+like load_precompiled_shader, so every byte is copied twice. The pack is mapped, its
+index parsed, and payloads are copied once, from the mapping into staging.
+
+The first run shows the cost of opening files and faulting pages in. After that both
+paths read from the page cache. Clear it between runs for truly cold numbers.
+
+Usage: asset_bench <pack> [--root dir] [--iterations N]
+*/
+
+#include "util/asset_pack.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+namespace {
+    double elapsed_ms(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    size_t load_loose(const std::vector<std::string> &paths, std::vector<char> &staging) {
+        size_t total = 0;
+        for (auto &path : paths) {
+            std::ifstream file(path, std::ios::ate | std::ios::binary);
+            if (!file.is_open()) {
+                throw std::runtime_error("Failed to open file " + path);
+            }
+            std::vector<char> data((size_t)file.tellg());
+            file.seekg(0);
+            file.read(data.data(), data.size());
+
+            memcpy(staging.data(), data.data(), data.size());
+            total += data.size();
+        }
+        return total;
+    }
+
+    size_t load_pack(const std::string &filename, std::vector<char> &staging) {
+        asset_pack::Reader pack(filename);
+        size_t total = 0;
+        for (auto &[name, asset] : pack.get_assets()) {
+            memcpy(staging.data(), asset.data, asset.size);
+            total += asset.size;
+        }
+        return total;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string pack_filename;
+    std::string root = ".";
+    size_t iterations = 10;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--root" && i + 1 < argc) {
+            root = argv[++i];
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::stoul(argv[++i]);
+        } else if (arg[0] != '-') {
+            pack_filename = arg;
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (pack_filename.empty()) {
+        std::cerr << "Usage: asset_bench <pack> [--root dir] [--iterations N]" << std::endl;
+        return 1;
+    }
+
+    try {
+        std::vector<std::string> paths;
+        size_t largest = 0;
+        {
+            asset_pack::Reader pack(pack_filename);
+            for (auto &[name, asset] : pack.get_assets()) {
+                paths.push_back(root + "/" + name);
+                largest = std::max(largest, asset.size);
+            }
+        }
+        std::vector<char> staging(largest);
+
+        for (auto &[mode, load] : {
+            std::make_pair(std::string("loose"), std::function<size_t()>([&]() { return load_loose(paths, staging); })),
+            std::make_pair(std::string("pack"), std::function<size_t()>([&]() { return load_pack(pack_filename, staging); }))
+        }) {
+            auto start = std::chrono::steady_clock::now();
+            size_t bytes = load();
+            double first_ms = elapsed_ms(start);
+
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                load();
+            }
+            double average_ms = elapsed_ms(start) / iterations;
+
+            std::cout << std::fixed << std::setprecision(3) << mode << ": " << paths.size() << " assets, "
+                << bytes / (1024.0 * 1024.0) << " MB, first " << first_ms << " ms, then " << average_ms << " ms ("
+                << bytes / (1024.0 * 1024.0) / (average_ms / 1000.0) << " MB/s)" << std::endl;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
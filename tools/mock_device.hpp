@@ -0,0 +1,502 @@
+/*
+Host memory implementation of vk_mem::Device.
+
+Simulates the memory types, heaps and alignment rules of a device so the Manager can
+run without a GPU. Handles are counters, host visible memory is backed by host
+allocations so mapped writes and defragmentation copies really move bytes, device
+local memory only exists as bookkeeping.
+
+Misuse the validation layers would report throws std::runtime_error: binding at a
+misaligned or out of range offset, binding to a memory type the requirements exclude,
+mapping device local memory or freeing memory that still has resources bound.
+
+set_next_requirements replaces the simulated requirements of the next buffer or image,
+so resources recorded on another device can be recreated exactly.
+*/
+
+#ifndef MOCK_DEVICE_HPP
+#define MOCK_DEVICE_HPP
+
+#include "vulkan_device.hpp"
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+#include <algorithm>
+
+namespace mock {
+
+    struct Profile {
+        std::string name;
+        std::vector<vk::MemoryHeap> heaps;
+        std::vector<vk::MemoryType> types;
+        vk::DeviceSize buffer_alignment;    // Alignment of buffers without uniform or storage usage
+        vk::DeviceSize image_alignment;     // Alignment of optimal tiling images
+        vk::DeviceSize dedicated_image_size; // Attachments from this size on prefer dedicated memory
+        vk::PhysicalDeviceLimits limits = {};
+    };
+
+    // Discrete GPU: 8 GiB VRAM with a 256 MiB host visible window, system memory over PCIe
+    inline Profile discrete_profile() {
+        Profile profile;
+        profile.name = "discrete";
+        profile.heaps = {
+            vk::MemoryHeap {8ull << 30, vk::MemoryHeapFlagBits::eDeviceLocal},
+            vk::MemoryHeap {16ull << 30, vk::MemoryHeapFlags()},
+            vk::MemoryHeap {256ull << 20, vk::MemoryHeapFlagBits::eDeviceLocal}
+        };
+        profile.types = {
+            vk::MemoryType {vk::MemoryPropertyFlagBits::eDeviceLocal, 0},
+            vk::MemoryType {vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, 1},
+            vk::MemoryType {vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostCached, 1},
+            vk::MemoryType {vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, 2}
+        };
+        profile.buffer_alignment = 16;
+        profile.image_alignment = 64 * 1024;
+        profile.dedicated_image_size = 4 * 1024 * 1024;
+        profile.limits.minUniformBufferOffsetAlignment = 256;
+        profile.limits.minStorageBufferOffsetAlignment = 32;
+        profile.limits.nonCoherentAtomSize = 64;
+        profile.limits.bufferImageGranularity = 1024;
+        return profile;
+    }
+
+    // Integrated tiler: one shared heap, cached memory is not coherent, transient attachments
+    // can live in lazily allocated memory that stays uncommitted
+    inline Profile integrated_profile() {
+        Profile profile;
+        profile.name = "integrated";
+        profile.heaps = {
+            vk::MemoryHeap {4ull << 30, vk::MemoryHeapFlagBits::eDeviceLocal}
+        };
+        profile.types = {
+            vk::MemoryType {vk::MemoryPropertyFlagBits::eDeviceLocal, 0},
+            vk::MemoryType {vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, 0},
+            vk::MemoryType {vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCached, 0},
+            vk::MemoryType {vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated, 0}
+        };
+        profile.buffer_alignment = 64;
+        profile.image_alignment = 4096;
+        profile.dedicated_image_size = 16 * 1024 * 1024;
+        profile.limits.minUniformBufferOffsetAlignment = 64;
+        profile.limits.minStorageBufferOffsetAlignment = 64;
+        profile.limits.nonCoherentAtomSize = 64;
+        profile.limits.bufferImageGranularity = 4096;
+        return profile;
+    }
+
+    // Memory requirements reported for a resource instead of the simulated ones
+    struct Requirements {
+        vk::DeviceSize size;
+        vk::DeviceSize alignment;
+        uint32_t type_bits;
+        bool prefers_dedicated;
+        bool requires_dedicated;
+    };
+
+    struct Counters {
+        uint64_t allocations = 0;       // allocate_memory calls
+        uint64_t dedicated_allocations = 0;
+        uint64_t live_allocations = 0;
+        uint64_t live_buffers = 0;
+        uint64_t live_images = 0;
+        uint64_t binds = 0;
+        uint64_t maps = 0;
+        uint64_t flushes = 0;
+        uint64_t invalidates = 0;
+        uint64_t copies = 0;
+        uint64_t bytes_copied = 0;
+        uint64_t barriers = 0;
+        std::vector<vk::DeviceSize> heap_usage;
+        std::vector<vk::DeviceSize> heap_peak;
+    };
+
+    class MockDevice : public vk_mem::Device {
+        public:
+        explicit MockDevice(const Profile &profile) : profile(profile) {
+            counters.heap_usage.resize(profile.heaps.size());
+            counters.heap_peak.resize(profile.heaps.size());
+        }
+
+        Counters get_counters() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return counters;
+        }
+
+        // Only applies to the next create_buffer or create_image call
+        void set_next_requirements(const Requirements &requirements) {
+            std::lock_guard<std::mutex> lock(mutex);
+            next_requirements = requirements;
+            has_next_requirements = true;
+        }
+
+        vk::PhysicalDeviceProperties get_properties() override {
+            vk::PhysicalDeviceProperties properties = {};
+            properties.limits = profile.limits;
+            return properties;
+        }
+
+        vk::PhysicalDeviceMemoryProperties get_memory_properties() override {
+            vk::PhysicalDeviceMemoryProperties properties = {};
+            properties.memoryHeapCount = (uint32_t)profile.heaps.size();
+            properties.memoryTypeCount = (uint32_t)profile.types.size();
+            for (size_t i = 0; i < profile.heaps.size(); i++) {
+                properties.memoryHeaps[i] = profile.heaps[i];
+            }
+            for (size_t i = 0; i < profile.types.size(); i++) {
+                properties.memoryTypes[i] = profile.types[i];
+            }
+            return properties;
+        }
+
+        // Other processes are simulated as holding a tenth of each heap
+        bool get_memory_budget(vk::DeviceSize *budget, vk::DeviceSize *usage) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < profile.heaps.size(); i++) {
+                budget[i] = profile.heaps[i].size * 9 / 10;
+                usage[i] = counters.heap_usage[i] + profile.heaps[i].size / 10;
+            }
+            return true;
+        }
+
+        vk::Buffer create_buffer(const vk::BufferCreateInfo &create_info) override {
+            Resource resource;
+            resource.size = create_info.size;
+            resource.alignment = profile.buffer_alignment;
+            if (create_info.usage & (vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eUniformTexelBuffer)) {
+                resource.alignment = std::max(resource.alignment, profile.limits.minUniformBufferOffsetAlignment);
+            }
+            if (create_info.usage & (vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eStorageTexelBuffer)) {
+                resource.alignment = std::max(resource.alignment, profile.limits.minStorageBufferOffsetAlignment);
+            }
+            resource.type_bits = 0;
+            for (size_t i = 0; i < profile.types.size(); i++) {
+                if (!(profile.types[i].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated)) {
+                    resource.type_bits |= 1u << i;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            apply_next_requirements(resource);
+            uint64_t id = ++next_id;
+            buffers[id] = resource;
+            ++counters.live_buffers;
+            return vk::Buffer(reinterpret_cast<VkBuffer>(id));
+        }
+
+        void destroy_buffer(const vk::Buffer &buffer) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            destroy(buffers, handle_id<VkBuffer>(buffer), "buffer");
+            --counters.live_buffers;
+        }
+
+        vk::MemoryRequirements get_buffer_memory_requirements(const vk::Buffer &buffer, vk::MemoryDedicatedRequirements &dedicated_reqs) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            const Resource &resource = find(buffers, handle_id<VkBuffer>(buffer), "buffer");
+            dedicated_reqs.prefersDedicatedAllocation = resource.prefers_dedicated ? VK_TRUE : VK_FALSE;
+            dedicated_reqs.requiresDedicatedAllocation = resource.requires_dedicated ? VK_TRUE : VK_FALSE;
+            return requirements(resource);
+        }
+
+        void bind_buffer_memory(const vk::Buffer &buffer, const vk::DeviceMemory &memory, const vk::DeviceSize offset) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            bind(find(buffers, handle_id<VkBuffer>(buffer), "buffer"), handle_id<VkDeviceMemory>(memory), offset);
+        }
+
+        vk::Image create_image(const vk::ImageCreateInfo &create_info) override {
+            vk::DeviceSize texel_size = format_size(create_info.format) * (uint32_t)create_info.samples;
+            vk::DeviceSize size = 0;
+            uint32_t width = create_info.extent.width, height = create_info.extent.height;
+            for (uint32_t level = 0; level < create_info.mipLevels; level++) {
+                size += (vk::DeviceSize)width * height * create_info.extent.depth * texel_size;
+                width = std::max(1u, width / 2);
+                height = std::max(1u, height / 2);
+            }
+            size *= create_info.arrayLayers;
+
+            Resource resource;
+            bool optimal = create_info.tiling == vk::ImageTiling::eOptimal;
+            resource.alignment = optimal ? profile.image_alignment : profile.buffer_alignment;
+            resource.size = integer_step(size, resource.alignment);
+            resource.attachment = (bool)(create_info.usage & (vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment));
+
+            // Optimal images are restricted to device local types, like on most drivers,
+            // lazily allocated types are only offered to transient attachments
+            bool transient = (bool)(create_info.usage & vk::ImageUsageFlagBits::eTransientAttachment);
+            resource.type_bits = 0;
+            for (size_t i = 0; i < profile.types.size(); i++) {
+                vk::MemoryPropertyFlags flags = profile.types[i].propertyFlags;
+                bool lazy = (bool)(flags & vk::MemoryPropertyFlagBits::eLazilyAllocated);
+                if ((!optimal || (flags & vk::MemoryPropertyFlagBits::eDeviceLocal)) && (!lazy || transient)) {
+                    resource.type_bits |= 1u << i;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            apply_next_requirements(resource);
+            uint64_t id = ++next_id;
+            images[id] = resource;
+            ++counters.live_images;
+            return vk::Image(reinterpret_cast<VkImage>(id));
+        }
+
+        void destroy_image(const vk::Image &image) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            destroy(images, handle_id<VkImage>(image), "image");
+            --counters.live_images;
+        }
+
+        vk::MemoryRequirements get_image_memory_requirements(const vk::Image &image, vk::MemoryDedicatedRequirements &dedicated_reqs) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            const Resource &resource = find(images, handle_id<VkImage>(image), "image");
+            bool dedicated = resource.prefers_dedicated || (resource.attachment && resource.size >= profile.dedicated_image_size);
+            dedicated_reqs.prefersDedicatedAllocation = dedicated ? VK_TRUE : VK_FALSE;
+            dedicated_reqs.requiresDedicatedAllocation = resource.requires_dedicated ? VK_TRUE : VK_FALSE;
+            return requirements(resource);
+        }
+
+        void bind_image_memory(const vk::Image &image, const vk::DeviceMemory &memory, const vk::DeviceSize offset) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            bind(find(images, handle_id<VkImage>(image), "image"), handle_id<VkDeviceMemory>(memory), offset);
+        }
+
+        vk::DeviceMemory allocate_memory(const vk::MemoryAllocateInfo &alloc_info) override {
+            if (alloc_info.memoryTypeIndex >= profile.types.size()) {
+                throw std::runtime_error("Invalid memory type");
+            }
+            const vk::MemoryType &type = profile.types[alloc_info.memoryTypeIndex];
+
+            std::lock_guard<std::mutex> lock(mutex);
+            vk::DeviceSize &usage = counters.heap_usage[type.heapIndex];
+            if (usage + alloc_info.allocationSize > profile.heaps[type.heapIndex].size) {
+                throw vk::OutOfDeviceMemoryError("Mock heap exhausted");
+            }
+            usage += alloc_info.allocationSize;
+            counters.heap_peak[type.heapIndex] = std::max(counters.heap_peak[type.heapIndex], usage);
+
+            Memory memory;
+            memory.size = alloc_info.allocationSize;
+            memory.type = alloc_info.memoryTypeIndex;
+            if (type.propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+                memory.data.reset(new uint8_t[memory.size]);
+            }
+
+            uint64_t id = ++next_id;
+            memories[id] = std::move(memory);
+            ++counters.allocations;
+            if (alloc_info.pNext != nullptr) {
+                ++counters.dedicated_allocations;
+            }
+            ++counters.live_allocations;
+            return vk::DeviceMemory(reinterpret_cast<VkDeviceMemory>(id));
+        }
+
+        void free_memory(const vk::DeviceMemory &memory) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            uint64_t id = handle_id<VkDeviceMemory>(memory);
+            Memory &allocation = find(memories, id, "memory");
+            if (allocation.bound > 0) {
+                throw std::runtime_error("Memory freed while resources are still bound to it");
+            }
+            counters.heap_usage[profile.types[allocation.type].heapIndex] -= allocation.size;
+            memories.erase(id);
+            --counters.live_allocations;
+        }
+
+        void* map_memory(const vk::DeviceMemory &memory) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            Memory &allocation = find(memories, handle_id<VkDeviceMemory>(memory), "memory");
+            if (!allocation.data) {
+                throw std::runtime_error("Mapping memory that is not host visible");
+            }
+            if (allocation.mapped) {
+                throw std::runtime_error("Memory is already mapped");
+            }
+            allocation.mapped = true;
+            ++counters.maps;
+            return allocation.data.get();
+        }
+
+        void unmap_memory(const vk::DeviceMemory &memory) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            Memory &allocation = find(memories, handle_id<VkDeviceMemory>(memory), "memory");
+            if (!allocation.mapped) {
+                throw std::runtime_error("Unmapping memory that is not mapped");
+            }
+            allocation.mapped = false;
+        }
+
+        void flush_memory(const vk::MappedMemoryRange &range) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            check_range(range);
+            ++counters.flushes;
+        }
+
+        void invalidate_memory(const vk::MappedMemoryRange &range) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            check_range(range);
+            ++counters.invalidates;
+        }
+
+        // Lazily allocated memory is never committed, attachments are assumed to stay in tile memory
+        vk::DeviceSize get_memory_commitment(const vk::DeviceMemory &memory) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            const Memory &allocation = find(memories, handle_id<VkDeviceMemory>(memory), "memory");
+            if (profile.types[allocation.type].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated) {
+                return 0;
+            }
+            return allocation.size;
+        }
+
+        // Executes right away, there is no queue to submit to
+        void copy_buffer(vk::CommandBuffer&, const vk::Buffer &src, const vk::Buffer &dst, const vk::BufferCopy &region) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            const Resource &source = find(buffers, handle_id<VkBuffer>(src), "buffer");
+            const Resource &destination = find(buffers, handle_id<VkBuffer>(dst), "buffer");
+            if (region.srcOffset + region.size > source.size || region.dstOffset + region.size > destination.size) {
+                throw std::runtime_error("Copy region out of range");
+            }
+
+            Memory &src_memory = find(memories, source.memory, "memory");
+            Memory &dst_memory = find(memories, destination.memory, "memory");
+            if (src_memory.data && dst_memory.data) {
+                memcpy(dst_memory.data.get() + destination.offset + region.dstOffset,
+                    src_memory.data.get() + source.offset + region.srcOffset, (size_t)region.size);
+            }
+            ++counters.copies;
+            counters.bytes_copied += region.size;
+        }
+
+        void memory_barrier(vk::CommandBuffer&, const vk::PipelineStageFlags, const vk::PipelineStageFlags, const vk::MemoryBarrier&) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++counters.barriers;
+        }
+
+        private:
+        struct Resource {
+            vk::DeviceSize size = 0;
+            vk::DeviceSize alignment = 1;
+            uint32_t type_bits = 0;
+            bool attachment = false;
+            bool prefers_dedicated = false;
+            bool requires_dedicated = false;
+            uint64_t memory = 0;        // 0 until bound
+            vk::DeviceSize offset = 0;
+        };
+
+        struct Memory {
+            vk::DeviceSize size = 0;
+            uint32_t type = 0;
+            uint32_t bound = 0;
+            bool mapped = false;
+            std::unique_ptr<uint8_t[]> data;    // Only for host visible types
+        };
+
+        Profile profile;
+        std::mutex mutex;
+        uint64_t next_id = 0;
+        std::unordered_map<uint64_t, Resource> buffers;
+        std::unordered_map<uint64_t, Resource> images;
+        std::unordered_map<uint64_t, Memory> memories;
+        Counters counters;
+        Requirements next_requirements = {};
+        bool has_next_requirements = false;
+
+        template<typename Raw, typename Handle>
+        static uint64_t handle_id(const Handle &handle) {
+            return reinterpret_cast<uint64_t>(static_cast<Raw>(handle));
+        }
+
+        static vk::DeviceSize integer_step(vk::DeviceSize val, vk::DeviceSize step) {
+            return ((val + step - 1) / step) * step;
+        }
+
+        static vk::DeviceSize format_size(const vk::Format format) {
+            switch (format) {
+                case vk::Format::eR8Unorm:
+                    return 1;
+                case vk::Format::eR16G16B16A16Sfloat:
+                case vk::Format::eR32G32Sfloat:
+                    return 8;
+                case vk::Format::eR32G32B32A32Sfloat:
+                    return 16;
+                default:
+                    return 4;
+            }
+        }
+
+        template<typename T>
+        static T& find(std::unordered_map<uint64_t, T> &map, const uint64_t id, const char *kind) {
+            auto it = map.find(id);
+            if (it == map.end()) {
+                throw std::runtime_error(std::string("Unknown ") + kind + " handle");
+            }
+            return it->second;
+        }
+
+        void destroy(std::unordered_map<uint64_t, Resource> &map, const uint64_t id, const char *kind) {
+            Resource &resource = find(map, id, kind);
+            if (resource.memory != 0) {
+                find(memories, resource.memory, "memory").bound--;
+            }
+            map.erase(id);
+        }
+
+        void apply_next_requirements(Resource &resource) {
+            if (!has_next_requirements) {
+                return;
+            }
+            resource.size = next_requirements.size;
+            resource.alignment = std::max<vk::DeviceSize>(next_requirements.alignment, 1);
+            resource.type_bits = next_requirements.type_bits;
+            resource.attachment = false;
+            resource.prefers_dedicated = next_requirements.prefers_dedicated;
+            resource.requires_dedicated = next_requirements.requires_dedicated;
+            has_next_requirements = false;
+        }
+
+        vk::MemoryRequirements requirements(const Resource &resource) const {
+            return vk::MemoryRequirements {integer_step(resource.size, resource.alignment), resource.alignment, resource.type_bits};
+        }
+
+        void bind(Resource &resource, const uint64_t memory_id, const vk::DeviceSize offset) {
+            Memory &memory = find(memories, memory_id, "memory");
+            if (resource.memory != 0) {
+                throw std::runtime_error("Resource is already bound");
+            }
+            if (!(resource.type_bits & (1u << memory.type))) {
+                throw std::runtime_error("Memory type not allowed by the resource requirements");
+            }
+            if (offset % resource.alignment != 0) {
+                throw std::runtime_error("Bind offset " + std::to_string(offset) + " violates alignment " + std::to_string(resource.alignment));
+            }
+            if (offset + integer_step(resource.size, resource.alignment) > memory.size) {
+                throw std::runtime_error("Resource does not fit the memory it is bound to");
+            }
+            resource.memory = memory_id;
+            resource.offset = offset;
+            memory.bound++;
+            ++counters.binds;
+        }
+
+        void check_range(const vk::MappedMemoryRange &range) {
+            Memory &memory = find(memories, handle_id<VkDeviceMemory>(range.memory), "memory");
+            vk::DeviceSize atom = profile.limits.nonCoherentAtomSize;
+            if (!memory.mapped) {
+                throw std::runtime_error("Flushed memory is not mapped");
+            }
+            if (range.offset % atom != 0 || (range.size != VK_WHOLE_SIZE && range.size % atom != 0 && range.offset + range.size != memory.size)) {
+                throw std::runtime_error("Mapped range is not aligned to nonCoherentAtomSize");
+            }
+            if (range.size != VK_WHOLE_SIZE && range.offset + range.size > memory.size) {
+                throw std::runtime_error("Mapped range out of bounds");
+            }
+        }
+    };
+}
+
+#endif // MOCK_DEVICE_HPP
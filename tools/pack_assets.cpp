@@ -0,0 +1,87 @@
+/*
+Packs loose asset files into an asset pack.
+
+Directories are added recursively. Assets are named by their path relative to the
+root, with forward slashes, which is the name the engine looks them up by. The type
+is taken from the extension.
+
+Usage: pack_assets <output> [--root dir] <files and directories...>
+*/
+
+#include "util/asset_pack.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: pack_assets <output> [--root dir] <files and directories...>" << std::endl;
+        return 1;
+    }
+
+    std::string output = argv[1];
+    fs::path root = ".";
+    std::vector<fs::path> inputs;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--root" && i + 1 < argc) {
+            root = argv[++i];
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+
+    // Sorted so the same inputs always produce the same pack
+    std::vector<fs::path> files;
+    for (auto &input : inputs) {
+        fs::path path = root / input;
+        if (fs::is_directory(path)) {
+            for (auto &entry : fs::recursive_directory_iterator(path)) {
+                if (entry.is_regular_file()) {
+                    files.push_back(entry.path());
+                }
+            }
+        } else if (fs::is_regular_file(path)) {
+            files.push_back(path);
+        } else {
+            std::cerr << "No such file or directory " << path << std::endl;
+            return 1;
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    try {
+        asset_pack::Writer writer(output);
+        uint64_t total = 0;
+        for (auto &path : files) {
+            std::string name = fs::relative(path, root).generic_string();
+
+            std::ifstream file(path, std::ios::ate | std::ios::binary);
+            if (!file.is_open()) {
+                throw std::runtime_error("Failed to open file " + path.string());
+            }
+            std::vector<char> data((size_t)file.tellg());
+            file.seekg(0);
+            file.read(data.data(), data.size());
+
+            asset_pack::Type type = asset_pack::type_from_path(name);
+            writer.add(name, type, data.data(), data.size());
+            total += data.size();
+            std::cout << "  " << name << " (" << data.size() << " bytes, type " << (uint32_t)type << ")" << std::endl;
+        }
+        writer.finish();
+
+        std::cout << "Packed " << files.size() << " assets, " << total << " bytes of payload into " << output << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
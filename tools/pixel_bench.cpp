@@ -0,0 +1,113 @@
+/*
+Pixel format conversion throughput.
+
+Runs every pixel_convert kernel over the same random image with the SIMD path built
+for this machine and with the scalar fallback, checks that both write the same bytes
+and reports MB/s of source data. The float input mixes normal, subnormal, out of range
+and special values so every branch of the half and packed float conversions is compared.
+
+Usage: pixel_bench [--size N] [--iterations N]
+*/
+
+#include "pixel_convert.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+namespace {
+    struct Kernel {
+        std::string name;
+        bool float_input;   // Reads the float image rather than the random bytes
+        size_t per_pixel;   // Elements converted per pixel, 4 for kernels converting single values
+        size_t src_size;    // Bytes per element
+        size_t dst_size;
+        void (*simd)(const void*, size_t, void*);
+        void (*scalar)(const void*, size_t, void*);
+    };
+
+    template<typename Src, typename Dst, void (*Function)(const Src*, const size_t, Dst*)>
+    void erase(const void *src, size_t count, void *dst) {
+        Function(static_cast<const Src*>(src), count, static_cast<Dst*>(dst));
+    }
+
+    double measure_ms(void (*kernel)(const void*, size_t, void*), const std::vector<uint8_t> &src, const size_t count, std::vector<uint8_t> &dst, const size_t iterations) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            kernel(src.data(), count, dst.data());
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t size = 2048;
+    size_t iterations = 20;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            size = std::stoul(argv[++i]);
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    // An odd pixel count leaves a tail for the scalar loop
+    size_t pixels = (size_t)size * size + 3;
+    std::mt19937 rng(1234);
+
+    std::vector<uint8_t> bytes(pixels * 4);
+    for (auto &value : bytes) {
+        value = (uint8_t)rng();
+    }
+
+    std::vector<uint8_t> floats(pixels * 4 * sizeof(float));
+    {
+        const float specials[] = {0.0f, -0.0f, 65504.0f, 65520.0f, 1e-8f, 6.1e-5f, 3e-8f,
+            std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN()};
+        std::uniform_real_distribution<float> exponent(-30.0f, 18.0f);
+        float *values = reinterpret_cast<float*>(floats.data());
+        for (size_t i = 0; i < pixels * 4; i++) {
+            values[i] = i % 16 == 0 ? specials[(i / 16) % 10] : ((rng() & 1) ? -1.0f : 1.0f) * std::exp2(exponent(rng));
+        }
+    }
+
+    const Kernel kernels[] = {
+        {"expand RGB to RGBA", false, 1, 3, 4, erase<uint8_t, uint8_t, pixel_convert::expand_rgb_to_rgba>, erase<uint8_t, uint8_t, pixel_convert::expand_rgb_to_rgba_scalar>},
+        {"premultiply alpha", false, 1, 4, 4, erase<uint8_t, uint8_t, pixel_convert::premultiply_alpha>, erase<uint8_t, uint8_t, pixel_convert::premultiply_alpha_scalar>},
+        {"float to half", true, 4, 4, 2, erase<float, uint16_t, pixel_convert::float_to_half>, erase<float, uint16_t, pixel_convert::float_to_half_scalar>},
+        {"RGBA float to B10G11R11", true, 1, 16, 4, erase<float, uint32_t, pixel_convert::float_to_b10g11r11>, erase<float, uint32_t, pixel_convert::float_to_b10g11r11_scalar>},
+        {"unorm16 to float", true, 4, 2, 4, erase<uint16_t, float, pixel_convert::unorm16_to_float>, erase<uint16_t, float, pixel_convert::unorm16_to_float_scalar>},
+    };
+
+    std::cout << size << "x" << size << " pixels, " << iterations << " iterations" << std::endl;
+    bool mismatch = false;
+    for (auto &kernel : kernels) {
+        size_t count = pixels * kernel.per_pixel;
+        const std::vector<uint8_t> &src = kernel.float_input ? floats : bytes;
+
+        std::vector<uint8_t> simd_out(count * kernel.dst_size), scalar_out(count * kernel.dst_size);
+        double scalar_ms = measure_ms(kernel.scalar, src, count, scalar_out, iterations);
+        double simd_ms = measure_ms(kernel.simd, src, count, simd_out, iterations);
+
+        bool same = memcmp(simd_out.data(), scalar_out.data(), simd_out.size()) == 0;
+        mismatch |= !same;
+
+        double megabytes = count * kernel.src_size / (1024.0 * 1024.0);
+        std::cout << std::fixed << std::setprecision(0) << std::setw(24) << std::left << kernel.name
+            << " scalar " << std::setw(6) << std::right << megabytes / (scalar_ms / 1000.0) << " MB/s, SIMD "
+            << std::setw(6) << megabytes / (simd_ms / 1000.0) << " MB/s, " << std::setprecision(1) << scalar_ms / simd_ms << "x"
+            << (same ? "" : ", OUTPUT DIFFERS") << std::endl;
+    }
+
+    return mismatch ? 1 : 0;
+}
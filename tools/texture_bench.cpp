@@ -0,0 +1,128 @@
+/*
+Mip chain generation costs and savings.
+
+Measures the CPU fallback that builds mip chains on the worker threads, scalar against
+SSE2, checks that both produce the same pixels and reports how much the chain adds to
+the upload. GPU blits cannot be timed without a device.
+
+The sampling saving is a model of texture cache traffic for a texture drawn minified.
+Optimal tiling keeps 4x4 RGBA8 texels in a 64 byte line, so a pixel that steps k texels
+fetches min(64, 4 * k^2) bytes. Without mips k is the full minification. With trilinear
+filtering k is below 2 on the selected level plus half that on the next one, unless the
+level matches exactly.
+
+Usage: texture_bench [--size N] [--iterations N]
+*/
+
+#include "image_ops.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+    struct Options {
+        uint32_t size = 0;          // 0 runs the default sizes
+        size_t iterations = 10;
+    };
+
+    typedef void (*DownsampleFunction)(const uint8_t*, const uint32_t, const uint32_t, uint8_t*);
+
+    // Same as image_ops::generate_mip_chain with a chosen kernel
+    void generate_with(DownsampleFunction downsample, const uint8_t *src, const uint32_t width, const uint32_t height, const uint32_t level_count, uint8_t *dst) {
+        const uint8_t *previous = src;
+        for (uint32_t level = 1; level < level_count; level++) {
+            downsample(previous, image_ops::mip_extent(width, level - 1), image_ops::mip_extent(height, level - 1), dst);
+            previous = dst;
+            dst += (size_t)image_ops::mip_extent(width, level) * image_ops::mip_extent(height, level) * 4;
+        }
+    }
+
+    double measure_ms(DownsampleFunction downsample, const std::vector<uint8_t> &pixels, const uint32_t width, const uint32_t height, std::vector<uint8_t> &chain, const size_t iterations) {
+        uint32_t levels = image_ops::mip_levels(width, height);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            generate_with(downsample, pixels.data(), width, height, levels, chain.data());
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+    }
+
+    void generation(const uint32_t width, const uint32_t height, const Options &options) {
+        std::vector<uint8_t> pixels((size_t)width * height * 4);
+        std::mt19937 rng(1234);
+        for (auto &value : pixels) {
+            value = (uint8_t)rng();
+        }
+
+        uint32_t levels = image_ops::mip_levels(width, height);
+        size_t chain_size = image_ops::mip_chain_size(width, height, levels, 1);
+        std::vector<uint8_t> scalar(chain_size), simd(chain_size);
+
+        double scalar_ms = measure_ms(image_ops::box_downsample_scalar, pixels, width, height, scalar, options.iterations);
+        double simd_ms = measure_ms(image_ops::box_downsample, pixels, width, height, simd, options.iterations);
+        bool matches = memcmp(scalar.data(), simd.data(), chain_size) == 0;
+
+        double base_mb = pixels.size() / (1024.0 * 1024.0);
+        std::cout << std::fixed << std::setprecision(2)
+            << width << "x" << height << ": " << levels << " levels, "
+            << "scalar " << scalar_ms << " ms, simd " << simd_ms << " ms (" << base_mb / (simd_ms / 1000.0) << " MB/s of level 0), "
+            << "upload " << base_mb << " -> " << (pixels.size() + chain_size) / (1024.0 * 1024.0) << " MB"
+            << (matches ? "" : ", MISMATCH between kernels") << std::endl;
+    }
+
+    double bytes_per_pixel(const double step) {
+        return std::min(64.0, 4.0 * step * step);
+    }
+
+    void sampling(const uint32_t texture_size) {
+        std::cout << "Modelled texture fetch traffic for a " << texture_size << "^2 texture drawn to a square of" << std::endl;
+        for (uint32_t draw_size = texture_size; draw_size >= 64; draw_size /= 4) {
+            double step = (double)texture_size / draw_size;
+            double level_step = step / std::pow(2.0, std::floor(std::log2(step)));
+            double pixels = (double)draw_size * draw_size;
+
+            double without = pixels * bytes_per_pixel(step);
+            // At an exact level trilinear filtering does not touch the next one
+            double with = pixels * (bytes_per_pixel(level_step) + (level_step > 1.0 ? bytes_per_pixel(level_step / 2.0) : 0.0));
+
+            std::cout << std::fixed << std::setprecision(2) << "  " << draw_size << "^2 pixels: "
+                << without / (1024.0 * 1024.0) << " MB without mips, " << with / (1024.0 * 1024.0) << " MB with, "
+                << without / with << "x" << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            options.size = std::stoul(argv[++i]);
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            options.iterations = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<uint32_t> sizes = {256, 1024, 2048, 4096};
+    if (options.size != 0) {
+        sizes = {options.size};
+    }
+
+    for (uint32_t size : sizes) {
+        generation(size, size, options);
+    }
+    // Odd and non square extents exercise the edge handling
+    generation(sizes.back() - 1, sizes.back() / 2 + 3, options);
+
+    sampling(sizes.back());
+    return 0;
+}
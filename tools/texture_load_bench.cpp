@@ -0,0 +1,196 @@
+/*
+Texture load time and VRAM, stb decode against pre-compressed containers.
+
+The stb path decodes to RGBA8 and builds the mip chain on the CPU, as the streamer
+does when blits are unavailable. The cached path is a warm start with the texture
+cache, the source is mapped and hashed and the stored chain mapped and copied out.
+The container path reads a KTX2 or DDS file and hands its levels over as stored.
+Without a container argument a BC1 DDS with a full chain of the same extent is
+written next to the image, which measures parsing and I/O but not the quality of a
+real encoder.
+
+Usage: texture_load_bench [image] [container] [--iterations N]
+*/
+
+#include "texture_formats.hpp"
+#include "image_ops.hpp"
+#include "util/texture_cache.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstring>
+
+namespace {
+    double elapsed_ms(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double megabytes(const double bytes) {
+        return bytes / (1024.0 * 1024.0);
+    }
+
+    void write_value(std::ofstream &file, const uint32_t value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    // Legacy DXT1 header followed by random blocks for every level
+    void write_bc1_dds(const std::string &path, const uint32_t width, const uint32_t height) {
+        uint32_t levels = image_ops::mip_levels(width, height);
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to write " + path);
+        }
+
+        uint32_t header[32] = {};
+        header[0] = 0x20534444;     // "DDS "
+        header[1] = 124;            // Header size
+        header[2] = 0x000A1007;     // Caps, height, width, pixel format, mip count, linear size
+        header[3] = height;
+        header[4] = width;
+        header[5] = (uint32_t)vk_help::get_level_size(vk::Format::eBc1RgbaUnormBlock, width, height, 0);
+        header[7] = levels;
+        header[19] = 32;            // Pixel format size
+        header[20] = 0x4;           // Four character code
+        header[21] = 0x31545844;    // "DXT1"
+        header[27] = 0x401008;      // Complex, texture, mipmap
+        for (uint32_t value : header) {
+            write_value(file, value);
+        }
+
+        std::mt19937 rng(1234);
+        for (uint32_t level = 0; level < levels; level++) {
+            std::vector<uint32_t> blocks((size_t)vk_help::get_level_size(vk::Format::eBc1RgbaUnormBlock, width, height, level) / 4);
+            for (auto &value : blocks) {
+                value = rng();
+            }
+            file.write(reinterpret_cast<const char*>(blocks.data()), blocks.size() * 4);
+        }
+    }
+
+    void stb_path(const std::string &path, const size_t iterations, uint32_t &width, uint32_t &height) {
+        double decode_ms = 0.0, mips_ms = 0.0;
+        size_t vram = 0;
+        for (size_t i = 0; i < iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            int w, h, channels;
+            stbi_uc *pixels = stbi_load(path.c_str(), &w, &h, &channels, STBI_rgb_alpha);
+            if (!pixels) {
+                throw std::runtime_error("Failed to load " + path + ": " + stbi_failure_reason());
+            }
+            decode_ms += elapsed_ms(start);
+
+            start = std::chrono::steady_clock::now();
+            uint32_t levels = image_ops::mip_levels(w, h);
+            std::vector<uint8_t> mips(image_ops::mip_chain_size(w, h, levels, 1));
+            image_ops::generate_mip_chain(pixels, w, h, levels, mips.data());
+            mips_ms += elapsed_ms(start);
+
+            width = w;
+            height = h;
+            vram = (size_t)w * h * 4 + mips.size();
+            stbi_image_free(pixels);
+        }
+
+        std::cout << std::fixed << std::setprecision(2) << "stb " << width << "x" << height << " RGBA8: "
+            << decode_ms / iterations << " ms decode + " << mips_ms / iterations << " ms mips, "
+            << megabytes(vram) << " MB VRAM" << std::endl;
+    }
+
+    void cached_path(const std::string &path, const size_t iterations) {
+        texture_cache::Cache cache(path + ".bench_cache");
+        {
+            int w, h, channels;
+            stbi_uc *pixels = stbi_load(path.c_str(), &w, &h, &channels, STBI_rgb_alpha);
+            uint32_t levels = image_ops::mip_levels(w, h);
+            std::vector<uint8_t> mips(image_ops::mip_chain_size(w, h, levels, 1));
+            image_ops::generate_mip_chain(pixels, w, h, levels, mips.data());
+
+            mapped_file::File source(path);
+            cache.store(path, texture_cache::hash(source.data(), source.size()), w, h, levels, (uint32_t)vk::Format::eR8G8B8A8Unorm,
+                {{pixels, (size_t)w * h * 4}, {mips.data(), mips.size()}});
+            stbi_image_free(pixels);
+        }
+
+        double hash_ms = 0.0, load_ms = 0.0;
+        size_t size = 0;
+        std::vector<char> staging;
+        for (size_t i = 0; i < iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            mapped_file::File source(path);
+            uint64_t source_hash = texture_cache::hash(source.data(), source.size());
+            hash_ms += elapsed_ms(start);
+
+            start = std::chrono::steady_clock::now();
+            texture_cache::Entry entry;
+            if (!cache.find(path, source_hash, entry)) {
+                throw std::runtime_error("Texture cache missed on a warm start");
+            }
+            staging.resize(entry.size);
+            memcpy(staging.data(), entry.pixels, entry.size);
+            load_ms += elapsed_ms(start);
+            size = entry.size;
+        }
+
+        std::cout << std::fixed << std::setprecision(2) << "cached RGBA8: " << hash_ms / iterations << " ms hash + "
+            << load_ms / iterations << " ms map and copy, " << megabytes(size) << " MB VRAM" << std::endl;
+    }
+
+    void container_path(const std::string &path, const size_t iterations) {
+        double load_ms = 0.0;
+        vk_help::texture_file file;
+        for (size_t i = 0; i < iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            file = vk_help::load_texture_file(path);
+            load_ms += elapsed_ms(start);
+        }
+
+        size_t vram = 0;
+        for (auto &level : file.levels) {
+            vram += level.size;
+        }
+        std::cout << std::fixed << std::setprecision(2) << "container " << file.width << "x" << file.height << " "
+            << vk::to_string(file.format) << ", " << file.levels.size() << " levels: "
+            << load_ms / iterations << " ms load, " << megabytes(vram) << " MB VRAM" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> paths;
+    size_t iterations = 5;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::stoul(argv[++i]);
+        } else if (arg[0] != '-') {
+            paths.push_back(arg);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (paths.empty()) {
+        paths.push_back("textures/texture.jpg");
+    }
+
+    try {
+        uint32_t width = 0, height = 0;
+        stb_path(paths[0], iterations, width, height);
+        cached_path(paths[0], iterations);
+
+        std::string container = paths.size() > 1 ? paths[1] : paths[0] + ".bench.dds";
+        if (paths.size() == 1) {
+            write_bc1_dds(container, width, height);
+        }
+        container_path(container, iterations);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
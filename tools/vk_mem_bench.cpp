@@ -0,0 +1,307 @@
+/*
+vk_mem::Manager microbenchmarks on a mock device.
+
+Runs the real Manager on mock::MockDevice, so placement, record lookup and mapping
+are measured without a GPU. Device calls cost a hash map lookup instead of a driver
+call, the numbers are the Manager's own overhead. Manager logging is discarded
+while measuring.
+
+The threads mode runs create_uniform_buffer and free from 1 to --threads threads
+while the main thread calls begin_frame like a render thread, and reports how
+throughput scales with the thread count. It is not part of all.
+
+Usage: vk_mem_bench [churn|lookup|map|transient|threads|all] [--profile discrete|integrated]
+                    [--live N] [--iterations N] [--size KB] [--threads N]
+*/
+
+#include "vulkan_memory.hpp"
+#include "mock_device.hpp"
+
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+
+namespace {
+    struct Options {
+        std::string mode = "all";
+        std::string profile = "discrete";
+        size_t live = 4096;
+        size_t iterations = 200000;
+        size_t size_kb = 64;
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    };
+
+    // Silences the Manager's logging for the lifetime of the object
+    class MuteLog {
+        public:
+        MuteLog() : buffer(std::cout.rdbuf(nullptr)) {}
+        ~MuteLog() {
+            std::cout.rdbuf(buffer);
+            std::cout.clear();
+        }
+
+        private:
+        std::streambuf *buffer;
+    };
+
+    struct Bench {
+        mock::MockDevice *device;
+        vk_mem::Manager manager;
+
+        explicit Bench(const mock::Profile &profile) {
+            auto mock_device = std::make_unique<mock::MockDevice>(profile);
+            device = mock_device.get();
+            MuteLog mute;
+            manager = vk_mem::Manager(std::move(mock_device));
+        }
+
+        ~Bench() {
+            MuteLog mute;
+            manager.destroy();
+        }
+    };
+
+    // Mix of the buffers a frame creates: small uniforms served by slabs, vertex data and staging
+    vk_mem::BufferHandle create_random(vk_mem::Manager &manager, std::mt19937_64 &rng) {
+        uint32_t kind = rng() % 4;
+        switch (kind) {
+            case 0:
+                return manager.create_uniform_buffer(64 << (rng() % 6));
+            case 1:
+                return manager.create_vertex_buffer(1024 + rng() % (256 * 1024));
+            case 2:
+                return manager.create_index_buffer(1024 + rng() % (64 * 1024));
+            default:
+                return manager.create_transfer_buffer(4096 + rng() % (1024 * 1024));
+        }
+    }
+
+    double elapsed_ns(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void churn(const mock::Profile &profile, const Options &options) {
+        Bench bench(profile);
+        std::mt19937_64 rng(1234);
+        std::vector<vk_mem::BufferHandle> handles;
+
+        double ns;
+        {
+            MuteLog mute;
+            for (size_t i = 0; i < options.live; i++) {
+                handles.push_back(create_random(bench.manager, rng));
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < options.iterations; i++) {
+                size_t victim = rng() % handles.size();
+                bench.manager.free_immediate(handles[victim]);
+                handles[victim] = create_random(bench.manager, rng);
+            }
+            ns = elapsed_ns(start) / options.iterations;
+        }
+
+        mock::Counters counters = bench.device->get_counters();
+        std::cout << "churn: " << ns << " ns per free+create with " << options.live << " live buffers, "
+            << counters.allocations << " device allocations, " << counters.live_allocations << " still held" << std::endl;
+    }
+
+    void lookup(const mock::Profile &profile, const Options &options) {
+        Bench bench(profile);
+        std::mt19937_64 rng(1234);
+        std::vector<vk_mem::BufferHandle> handles;
+        {
+            MuteLog mute;
+            for (size_t i = 0; i < options.live; i++) {
+                handles.push_back(create_random(bench.manager, rng));
+            }
+        }
+
+        std::vector<uint32_t> order(options.iterations);
+        for (auto &index : order) {
+            index = (uint32_t)(rng() % handles.size());
+        }
+
+        vk::DeviceSize checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t index : order) {
+            checksum += bench.manager.get_buffer(handles[index]).offset;
+        }
+        double ns = elapsed_ns(start) / options.iterations;
+
+        std::cout << "lookup: " << ns << " ns per get_buffer over " << options.live << " live buffers (checksum " << checksum << ")" << std::endl;
+    }
+
+    void map(const mock::Profile &profile, const Options &options) {
+        Bench bench(profile);
+        vk::DeviceSize size = options.size_kb * 1024;
+        std::vector<char> source((size_t)size, 1);
+
+        vk_mem::BufferHandle dynamic, staging;
+        {
+            MuteLog mute;
+            // The memory uniform buffers use, device local on ReBAR and unified memory
+            dynamic = bench.manager.create_buffer(
+                size,
+                vk::BufferUsageFlagBits::eVertexBuffer,
+                vk_mem::MemoryPreference {
+                    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,   // Required
+                    vk::MemoryPropertyFlagBits::eDeviceLocal                                                // Preferred
+                }
+            );
+            staging = bench.manager.create_transfer_buffer(size);
+        }
+
+        for (auto &[name, handle] : {std::make_pair("dynamic vertex", dynamic), std::make_pair("staging", staging)}) {
+            size_t iterations = std::max<size_t>(1, options.iterations / 100);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                memcpy(bench.manager.mapMemory(handle), source.data(), (size_t)size);
+                bench.manager.unmapMemory(handle);
+            }
+            double seconds = elapsed_ns(start) / 1e9;
+
+            std::cout << "map " << name << ": " << size * iterations / seconds / (1024 * 1024) << " MB/s for "
+                << options.size_kb << " KB map+write+unmap" << std::endl;
+        }
+
+        mock::Counters counters = bench.device->get_counters();
+        std::cout << "map: " << counters.flushes << " flushes of non-coherent memory" << std::endl;
+    }
+
+    // A 1080p G-buffer with 4x MSAA color and depth, all resolved within the render pass
+    void transient(const mock::Profile &profile, const Options&) {
+        Bench bench(profile);
+        vk::Extent2D extent(1920, 1080);
+        std::vector<vk_mem::ImageHandle> attachments;
+        {
+            MuteLog mute;
+            for (vk::Format format : {vk::Format::eR8G8B8A8Unorm, vk::Format::eR16G16B16A16Sfloat, vk::Format::eR8G8B8A8Unorm}) {
+                attachments.push_back(bench.manager.create_transient_attachment(format, extent,
+                    vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment));
+            }
+            attachments.push_back(bench.manager.create_transient_attachment(vk::Format::eR8G8B8A8Unorm, extent,
+                vk::ImageUsageFlagBits::eColorAttachment, vk::SampleCountFlagBits::e4));
+            attachments.push_back(bench.manager.create_transient_attachment(vk::Format::eD32Sfloat, extent,
+                vk::ImageUsageFlagBits::eDepthStencilAttachment, vk::SampleCountFlagBits::e4));
+        }
+
+        vk::DeviceSize size = 0, committed = 0;
+        for (auto &handle : attachments) {
+            size += bench.manager.get_image(handle).size;
+            committed += bench.manager.get_committed_size(handle);
+        }
+        std::cout << "transient: " << attachments.size() << " attachments, " << size / (1024.0 * 1024.0) << " MB reserved, "
+            << committed / (1024.0 * 1024.0) << " MB committed" << std::endl;
+    }
+
+    // Each thread keeps a small window of live uniform buffers and replaces the oldest one
+    double threaded_run(const mock::Profile &profile, const size_t thread_count, const size_t iterations) {
+        Bench bench(profile);
+        MuteLog mute;
+
+        std::atomic<size_t> running(thread_count);
+        auto worker = [&](const uint64_t seed) {
+            std::mt19937_64 rng(seed);
+            std::vector<vk_mem::BufferHandle> window(64);
+            for (auto &handle : window) {
+                handle = bench.manager.create_uniform_buffer(64 << (rng() % 6));
+            }
+            for (size_t i = 0; i < iterations; i++) {
+                vk_mem::BufferHandle &handle = window[i % window.size()];
+                bench.manager.free(handle);
+                handle = bench.manager.create_uniform_buffer(64 << (rng() % 6));
+            }
+            for (auto &handle : window) {
+                bench.manager.free(handle);
+            }
+            --running;
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back(worker, i + 1);
+        }
+
+        // Every frame is treated as completed right away, retired buffers are destroyed on the next one
+        uint64_t frame = 0;
+        while (running > 0) {
+            bench.manager.begin_frame(frame + 1, frame);
+            ++frame;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        double seconds = elapsed_ns(start) / 1e9;
+        bench.manager.flush_frees();
+
+        return thread_count * iterations / seconds;
+    }
+
+    void threaded(const mock::Profile &profile, const Options &options) {
+        double single = 0.0;
+        for (size_t thread_count = 1; thread_count <= options.threads; thread_count *= 2) {
+            double ops = threaded_run(profile, thread_count, options.iterations);
+            if (thread_count == 1) {
+                single = ops;
+            }
+            std::cout << "threads " << thread_count << ": " << ops / 1e6 << " M free+create/s, "
+                << ops / thread_count / 1e6 << " M per thread, " << ops / single << "x one thread" << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--profile" && i + 1 < argc) {
+            options.profile = argv[++i];
+        } else if (arg == "--live" && i + 1 < argc) {
+            options.live = std::stoul(argv[++i]);
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            options.iterations = std::stoul(argv[++i]);
+        } else if (arg == "--size" && i + 1 < argc) {
+            options.size_kb = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg[0] != '-') {
+            options.mode = arg;
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    mock::Profile profile = options.profile == "integrated" ? mock::integrated_profile() : mock::discrete_profile();
+    std::cout << "Mock " << profile.name << " device" << std::endl;
+
+    try {
+        if (options.mode == "churn" || options.mode == "all") {
+            churn(profile, options);
+        }
+        if (options.mode == "lookup" || options.mode == "all") {
+            lookup(profile, options);
+        }
+        if (options.mode == "map" || options.mode == "all") {
+            map(profile, options);
+        }
+        if (options.mode == "transient" || options.mode == "all") {
+            transient(profile, options);
+        }
+        if (options.mode == "threads") {
+            threaded(profile, options);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
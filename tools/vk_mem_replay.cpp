@@ -0,0 +1,351 @@
+/*
+Allocation trace replay.
+
+Replays a trace recorded by vk_mem::Manager::start_trace on a real Manager running over
+mock::MockDevice, with the memory types and heaps of the traced device and block sizes
+overridden from the command line. Buffers and images report the memory requirements
+they had when traced, including whether the driver preferred or required a dedicated
+allocation, so only the placement policy differs. In frames where the traced run
+moved buffers, defragmentation runs with the same byte budget.
+
+Slab slots take no device memory of their own, the slab buffers behind them are
+replayed like any other buffer. Allocations that were alive before the trace started
+are not known to the replay, their frees are skipped.
+
+Usage: vk_mem_replay <trace> [--initial MB] [--max MB] [--dedicated MB]
+*/
+
+#include "vulkan_memory.hpp"
+#include "mock_device.hpp"
+#include "util/alloc_trace.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+namespace {
+    const uint64_t MIB = 1024 * 1024;
+
+    // Overrides of the per heap defaults, 0 keeps the default
+    struct Policy {
+        uint64_t initial_block_size = 0;
+        uint64_t max_block_size = 0;
+        uint64_t dedicated_threshold = 0;
+    };
+
+    // Silences the Manager's logging for the lifetime of the object
+    class MuteLog {
+        public:
+        MuteLog() : buffer(std::cout.rdbuf(nullptr)) {}
+        ~MuteLog() {
+            std::cout.rdbuf(buffer);
+            std::cout.clear();
+        }
+
+        private:
+        std::streambuf *buffer;
+    };
+
+    /**
+     * The header only has memory types and heap sizes. Buffers and images created by the
+     * replay get the traced requirements, the rest of the profile only matters for the
+     * new buffers defragmentation creates. Optimal images only get pools of their own on
+     * devices with a bufferImageGranularity above 1 KiB, which the pools in the trace show.
+     */
+    mock::Profile trace_profile(const alloc_trace::Header &header, const bool optimal_image_pools) {
+        mock::Profile profile;
+        profile.name = "traced";
+        for (uint64_t heap_size : header.heap_sizes) {
+            profile.heaps.push_back(vk::MemoryHeap {heap_size, vk::MemoryHeapFlags()});
+        }
+        for (auto &type : header.memory_types) {
+            vk::MemoryPropertyFlags flags(type.property_flags);
+            profile.types.push_back(vk::MemoryType {flags, type.heap});
+            if (flags & vk::MemoryPropertyFlagBits::eDeviceLocal) {
+                profile.heaps[type.heap].flags |= vk::MemoryHeapFlagBits::eDeviceLocal;
+            }
+        }
+        profile.buffer_alignment = 256;
+        profile.image_alignment = 64 * 1024;
+        profile.dedicated_image_size = ~0ull;
+        profile.limits.minUniformBufferOffsetAlignment = 256;
+        profile.limits.minStorageBufferOffsetAlignment = 256;
+        profile.limits.nonCoherentAtomSize = 256;
+        profile.limits.bufferImageGranularity = optimal_image_pools ? 64 * 1024 : 1024;
+        return profile;
+    }
+
+    class Replay {
+        public:
+        Replay(const alloc_trace::Header &header, const Policy &policy, const bool optimal_image_pools);
+        ~Replay();
+
+        void apply(const alloc_trace::Event &event);
+        // Runs defragmentation still owed for the last traced moves
+        void finish();
+        void report(std::ostream &out);
+
+        private:
+        mock::MockDevice *device;
+        vk_mem::Manager manager;
+        size_t type_count;
+        vk::CommandBuffer command_buffer;
+
+        std::unordered_map<uint64_t, vk_mem::BufferHandle> buffers;
+        std::unordered_map<uint64_t, vk_mem::ImageHandle> images;
+        std::unordered_set<uint64_t> slots;
+
+        uint64_t placements = 0;
+        uint64_t frees = 0;
+        uint64_t slot_count = 0;
+        uint64_t maps = 0;
+        uint64_t frames = 0;
+        uint64_t unknown_frees = 0;
+        uint64_t traced_moves = 0;
+        uint64_t traced_bytes_moved = 0;
+        uint64_t move_budget = 0;
+        vk_mem::DefragmentationStats moved;
+
+        static uint64_t key(const alloc_trace::Event &event) {
+            return ((uint64_t)event.generation << 32) | event.index;
+        }
+
+        void expect(const alloc_trace::Event &event);
+        void place(const alloc_trace::Event &event);
+        void release(const alloc_trace::Event &event);
+    };
+
+    Replay::Replay(const alloc_trace::Header &header, const Policy &policy, const bool optimal_image_pools)
+        : type_count(header.memory_types.size()) {
+        auto mock_device = std::make_unique<mock::MockDevice>(trace_profile(header, optimal_image_pools));
+        device = mock_device.get();
+        MuteLog mute;
+        manager = vk_mem::Manager(std::move(mock_device));
+
+        for (uint32_t heap = 0; heap < header.heap_sizes.size(); heap++) {
+            vk_mem::BlockSizeConfig config = manager.get_block_sizes(heap);
+            if (policy.max_block_size) {
+                config.max_block_size = policy.max_block_size;
+                config.initial_block_size = std::min(config.initial_block_size, config.max_block_size);
+                config.dedicated_threshold = config.max_block_size / 2;
+            }
+            if (policy.initial_block_size) {
+                config.initial_block_size = std::min(policy.initial_block_size, config.max_block_size);
+            }
+            if (policy.dedicated_threshold) {
+                config.dedicated_threshold = policy.dedicated_threshold;
+            }
+            manager.set_block_sizes(heap, config);
+        }
+    }
+
+    Replay::~Replay() {
+        MuteLog mute;
+        manager.destroy();
+    }
+
+    void Replay::expect(const alloc_trace::Event &event) {
+        if (event.memory_type >= type_count) {
+            throw std::runtime_error("Trace references unknown memory type");
+        }
+        device->set_next_requirements(mock::Requirements {
+            event.size,
+            event.alignment,
+            1u << event.memory_type,
+            event.dedicated == (uint8_t)alloc_trace::Dedicated::Preferred,
+            event.dedicated == (uint8_t)alloc_trace::Dedicated::Required
+        });
+    }
+
+    // The requirements only allow the traced memory type, the preference just has to accept it
+    void Replay::place(const alloc_trace::Event &event) {
+        expect(event);
+        vk_mem::MemoryPreference preference {vk::MemoryPropertyFlags(event.property_flags)};
+
+        if ((alloc_trace::Op)event.op == alloc_trace::Op::CreateBuffer) {
+            buffers[key(event)] = manager.create_buffer(event.size, vk::BufferUsageFlags(event.usage), preference);
+        } else {
+            vk::ImageCreateInfo create_info(
+                vk::ImageCreateFlags(),
+                vk::ImageType::e2D,
+                vk::Format::eR8G8B8A8Unorm,
+                vk::Extent3D(1, 1, 1),
+                1,                                              // Mip levels
+                1,                                              // Array layers
+                vk::SampleCountFlagBits::e1,
+                (event.flags & alloc_trace::FLAG_OPTIMAL_IMAGE) ? vk::ImageTiling::eOptimal : vk::ImageTiling::eLinear,
+                vk::ImageUsageFlags(event.usage),
+                vk::SharingMode::eExclusive,
+                0,                                              // Queue family count
+                nullptr,                                        // Queue family indices
+                vk::ImageLayout::eUndefined
+            );
+            images[key(event)] = manager.create_image(create_info, preference);
+        }
+        ++placements;
+    }
+
+    // Frees in the trace happen once the memory is released, deferral already took place
+    void Replay::release(const alloc_trace::Event &event) {
+        if (event.flags & alloc_trace::FLAG_MOVED) {
+            return;
+        }
+
+        uint64_t id = key(event);
+        auto buffer = buffers.find(id);
+        auto image = images.find(id);
+        if (buffer != buffers.end()) {
+            manager.free(buffer->second);
+            buffers.erase(buffer);
+        } else if (image != images.end()) {
+            manager.free_image(image->second);
+            images.erase(image);
+        } else if (slots.erase(id) == 0) {
+            ++unknown_frees;
+            return;
+        }
+        manager.flush_frees();
+        ++frees;
+    }
+
+    void Replay::finish() {
+        if (move_budget == 0) {
+            return;
+        }
+        vk_mem::DefragmentationStats stats = manager.defragment(command_buffer, move_budget);
+        moved.allocations_moved += stats.allocations_moved;
+        moved.bytes_moved += stats.bytes_moved;
+        moved.bytes_reclaimed += stats.bytes_reclaimed;
+        move_budget = 0;
+    }
+
+    void Replay::apply(const alloc_trace::Event &event) {
+        alloc_trace::Op op = (alloc_trace::Op)event.op;
+        if (op != alloc_trace::Op::Move) {
+            finish();
+        }
+
+        switch (op) {
+            case alloc_trace::Op::CreateBuffer:
+            case alloc_trace::Op::CreateImage:
+                place(event);
+                break;
+            case alloc_trace::Op::CreateSlot:
+                slots.insert(key(event));
+                ++slot_count;
+                break;
+            case alloc_trace::Op::Free:
+                release(event);
+                break;
+            case alloc_trace::Op::Map:
+            case alloc_trace::Op::Unmap:
+                ++maps;
+                break;
+            case alloc_trace::Op::Frame:
+                manager.begin_frame(event.frame, event.size);
+                ++frames;
+                break;
+            case alloc_trace::Op::Move:
+                // Consecutive moves come from one defragment call
+                move_budget += event.size;
+                ++traced_moves;
+                traced_bytes_moved += event.size;
+                break;
+            default:
+                throw std::runtime_error("Unknown trace event");
+        }
+    }
+
+    void Replay::report(std::ostream &out) {
+        vk_mem::Statistics stats = manager.get_statistics();
+        mock::Counters counters = device->get_counters();
+
+        out << std::fixed << std::setprecision(2);
+        out << "  frames:              " << frames << std::endl;
+        out << "  placements:          " << placements << " (" << slot_count << " slab slots, " << maps << " map/unmap)" << std::endl;
+        out << "  frees:               " << frees << " (" << unknown_frees << " from before the trace)" << std::endl;
+        out << "  device allocations:  " << counters.allocations << " (" << counters.dedicated_allocations << " dedicated)" << std::endl;
+        out << "  moves:               " << moved.allocations_moved << " buffers, " << (double)moved.bytes_moved / MIB << " MiB ("
+            << traced_moves << " buffers, " << (double)traced_bytes_moved / MIB << " MiB traced)" << std::endl;
+
+        for (size_t i = 0; i < stats.heaps.size(); i++) {
+            const vk_mem::HeapStats &heap = stats.heaps[i];
+            uint64_t peak_reserved = counters.heap_peak[i];
+            if (peak_reserved == 0) {
+                continue;
+            }
+            out << "  heap " << i << ":" << std::endl;
+            out << "    peak reserved:     " << (double)peak_reserved / MIB << " MiB" << std::endl;
+            out << "    peak used:         " << (double)heap.peak_used / MIB << " MiB" << std::endl;
+            out << "    peak overhead:     " << 100.0 * (peak_reserved - std::min<uint64_t>(heap.peak_used, peak_reserved)) / peak_reserved << " %" << std::endl;
+            out << "    blocks left:       " << heap.block_count << ", " << (double)heap.used / MIB << " MiB used" << std::endl;
+            out << "    fragmentation:     " << 100.0 * heap.fragmentation() << " %" << std::endl;
+        }
+    }
+
+    uint64_t parse_mb(int &i, int argc, char** argv) {
+        if (i + 1 >= argc) {
+            throw std::runtime_error(std::string("Missing value for ") + argv[i]);
+        }
+        return (uint64_t)(std::stod(argv[++i]) * MIB);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: vk_mem_replay <trace> [--initial MB] [--max MB] [--dedicated MB]" << std::endl;
+        return 1;
+    }
+
+    try {
+        Policy policy;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--initial") {
+                policy.initial_block_size = parse_mb(i, argc, argv);
+            } else if (arg == "--max") {
+                policy.max_block_size = parse_mb(i, argc, argv);
+            } else if (arg == "--dedicated") {
+                policy.dedicated_threshold = parse_mb(i, argc, argv);
+            } else {
+                throw std::runtime_error("Unknown option " + arg);
+            }
+        }
+
+        alloc_trace::Reader reader(argv[1]);
+        std::vector<alloc_trace::Event> events;
+        alloc_trace::Event event;
+        bool optimal_image_pools = false;
+        while (reader.next(event)) {
+            events.push_back(event);
+            optimal_image_pools |= (event.pool & vk_mem::OPTIMAL_IMAGE_POOL) != 0;
+        }
+
+        Replay replay(reader.get_header(), policy, optimal_image_pools);
+        auto start = std::chrono::steady_clock::now();
+        {
+            MuteLog mute;
+            for (auto &e : events) {
+                replay.apply(e);
+            }
+            replay.finish();
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double ns = events.empty() ? 0.0 : std::chrono::duration<double, std::nano>(end - start).count() / events.size();
+        std::cout << "Replayed " << events.size() << " events from " << argv[1] << std::endl;
+        replay.report(std::cout);
+        std::cout << "  replay:              " << ns << " ns per event" << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}